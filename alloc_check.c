@@ -0,0 +1,198 @@
+// verifies that steady state frames do not allocate: plays a scripted session twice through input, layout and raster
+// and counts every allocation per frame and stage, the first pass warms up, the second has to be allocation free
+// ./alloc_check [document] [input trace], without a trace the built-in typing and scroll script is played
+// exits with 1 if a frame of the second pass allocated
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <linux/input-event-codes.h>
+
+#include "alloc_stats.h"
+#include "layout.h"
+#include "cpu_draw.h"
+#include "glyph.h"
+#include "input_trace.h"
+
+#define FRAME_WIDTH 1280
+#define FRAME_HEIGHT 800
+#define AXIS_VERTICAL 0 // WL_POINTER_AXIS_VERTICAL_SCROLL, this runs without wayland
+#define KEY_BACKSPACE_SYM 0xff08 // XKB_KEY_BackSpace, and without xkbcommon
+#define CURSOR_LINE 3
+
+enum stage {
+    STAGE_INPUT = 1,
+    STAGE_LAYOUT,
+    STAGE_RASTER,
+    STAGE_COUNT,
+};
+static const char *stage_names[STAGE_COUNT] = {"other", "input", "layout", "raster"};
+
+struct session {
+    struct document *doc;
+    struct thread_pool *pool;
+    struct cpu_tiler tiler;
+    struct layout layout;
+    struct cpu_target target;
+    size_t first_line;
+    int32_t scroll_remainder;
+    size_t cursor_byte;
+};
+
+// types a word and deletes it again, then scrolls like a wheel, a touchpad and a scrollbar drag would,
+// with clicks in between that redraw the same view
+static struct app_event *script(uint32_t *count) {
+    const int lines = SCROLL_UNITS_PER_LINE;
+    struct app_event *events = malloc(1024 * sizeof(*events));
+    uint32_t n = 0;
+    const char *typed = "allocation free ";
+    for (const char *c = typed; *c; c++) events[n++] = (struct app_event){.type = APP_EVENT_KEY, .a = *c, .b = *c};
+    for (const char *c = typed; *c; c++) events[n++] = (struct app_event){.type = APP_EVENT_KEY, .a = KEY_BACKSPACE_SYM};
+    for (int i = 0; i < 200; i++) {
+        events[n++] = (struct app_event){.type = APP_EVENT_POINTER_AXIS, .a = AXIS_VERTICAL, .b = 3 * lines};
+    }
+    for (int i = 0; i < 80; i++) {
+        events[n++] = (struct app_event){.type = APP_EVENT_POINTER_AXIS, .a = AXIS_VERTICAL, .b = -lines / 2};
+    }
+    for (int i = 0; i < 8; i++) {
+        events[n++] = (struct app_event){.type = APP_EVENT_POINTER_BUTTON, .a = BTN_LEFT, .b = 1};
+    }
+    for (int i = 0; i < 40; i++) {
+        events[n++] = (struct app_event){.type = APP_EVENT_POINTER_AXIS, .a = AXIS_VERTICAL, .b = (i < 20 ? 100 : -100) * lines};
+    }
+    *count = n;
+    return events;
+}
+
+// returns the byte the line of the cursor changed at, SIZE_MAX if the event did not edit
+static size_t apply_event(struct session *session, const struct app_event *event) {
+    if (event->type == APP_EVENT_POINTER_AXIS && event->a == AXIS_VERTICAL) {
+        session->first_line = layout_scroll(session->first_line, session->doc->line_count, event->b,
+                                            &session->scroll_remainder);
+    } else if (event->type == APP_EVENT_KEY && event->a == KEY_BACKSPACE_SYM && session->cursor_byte > 0) {
+        const char *s;
+        size_t length;
+        document_line(session->doc, CURSOR_LINE, &s, &length);
+        const size_t previous = utf8_previous(s, session->cursor_byte);
+        if (document_erase(session->doc, CURSOR_LINE, previous, session->cursor_byte - previous)) {
+            session->cursor_byte = previous;
+            return previous;
+        }
+    } else if (event->type == APP_EVENT_KEY && event->b >= 0x20) {
+        char bytes[4];
+        const int n = utf8_encode(event->b, bytes);
+        const size_t byte = session->cursor_byte;
+        if (document_insert(session->doc, CURSOR_LINE, byte, bytes, n)) {
+            session->cursor_byte += n;
+            return byte;
+        }
+    }
+    return SIZE_MAX;
+}
+
+static void add_counts(struct alloc_counts *total, const struct alloc_counts *counts) {
+    total->allocs += counts->allocs;
+    total->reallocs += counts->reallocs;
+    total->frees += counts->frees;
+    total->bytes += counts->bytes;
+}
+
+// one frame per event, returns the number of frames that allocated
+static int play(struct session *session, const struct app_event *events, uint32_t count, const char *pass,
+                bool report_frames) {
+    struct alloc_counts totals[STAGE_COUNT] = {0};
+    struct alloc_counts frame[ALLOC_MAX_STAGES];
+    int allocating_frames = 0;
+    session->first_line = 0;
+    session->scroll_remainder = 0;
+    session->cursor_byte = 0;
+    alloc_stats_take(frame);
+    for (uint32_t i = 0; i < count; i++) {
+        alloc_stats_stage(STAGE_INPUT);
+        const size_t edit_byte = apply_event(session, &events[i]);
+        alloc_stats_stage(STAGE_LAYOUT);
+        const struct view view = {.first_line = session->first_line, .width = FRAME_WIDTH, .height = FRAME_HEIGHT,
+                                  .font_size = 16, .background = 0xFF1E1E1E, .foreground = 0xFFD4D4D4,
+                                  .show_cursor = true, .cursor_line = CURSOR_LINE, .cursor_byte = session->cursor_byte};
+        // keystrokes take the same single line path as in main2.c
+        const bool line_only = edit_byte != SIZE_MAX &&
+                               layout_update_line(&session->layout, session->doc, &view, CURSOR_LINE, edit_byte);
+        const bool changed = line_only || layout_update(&session->layout, session->doc, &view);
+        alloc_stats_stage(STAGE_RASTER);
+        const struct layout *layout = &session->layout;
+        if (line_only) {
+            cpu_draw_region(&layout->list, &session->target, layout->damage_x0, layout->damage_y0, layout->damage_x1,
+                            layout->damage_y1);
+        } else if (changed) {
+            cpu_draw_list_parallel(&session->tiler, session->pool, &layout->list, &session->target);
+        }
+        alloc_stats_stage(0);
+        alloc_stats_take(frame);
+
+        bool allocated = false;
+        for (int stage = 1; stage < STAGE_COUNT; stage++) {
+            add_counts(&totals[stage], &frame[stage]);
+            if (frame[stage].allocs || frame[stage].reallocs || frame[stage].frees) allocated = true;
+        }
+        if (!allocated) continue;
+        allocating_frames++;
+        if (!report_frames) continue;
+        printf("%s frame %u (line %zu):", pass, i, session->first_line);
+        for (int stage = 1; stage < STAGE_COUNT; stage++) {
+            if (frame[stage].allocs || frame[stage].reallocs || frame[stage].frees) {
+                printf(" %s %lu allocs %lu reallocs %lu frees;", stage_names[stage], (unsigned long) frame[stage].allocs,
+                       (unsigned long) frame[stage].reallocs, (unsigned long) frame[stage].frees);
+            }
+        }
+        printf("\n");
+    }
+    printf("%s: %u frames, %d allocated\n", pass, count, allocating_frames);
+    for (int stage = 1; stage < STAGE_COUNT; stage++) {
+        printf("    %-6s %6lu allocs %6lu reallocs %6lu frees %10lu bytes\n", stage_names[stage],
+               (unsigned long) totals[stage].allocs, (unsigned long) totals[stage].reallocs,
+               (unsigned long) totals[stage].frees, (unsigned long) totals[stage].bytes);
+    }
+    return allocating_frames;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "example_text.txt";
+    struct document doc;
+    if (!document_load(&doc, path)) return 1;
+    document_index_lines(&doc, doc.size);
+    if (doc.line_count <= CURSOR_LINE) {
+        fprintf(stderr, "%s needs more than %d lines\n", path, CURSOR_LINE);
+        return 1;
+    }
+    struct thread_pool pool;
+    thread_pool_init(&pool, 0);
+
+    struct input_trace trace = {0};
+    struct app_event *events;
+    uint32_t count;
+    if (argc > 2) {
+        if (!input_trace_load(&trace, argv[2])) return 1;
+        events = trace.events;
+        count = trace.count;
+    } else {
+        events = script(&count);
+    }
+
+    struct session session = {.doc = &doc, .pool = &pool};
+    session.target = (struct cpu_target){calloc((size_t) FRAME_WIDTH * FRAME_HEIGHT, 4), FRAME_WIDTH, FRAME_HEIGHT,
+                                         FRAME_WIDTH};
+    // the first pass may grow buffers and fill the glyph cache, after it everything is warm
+    play(&session, events, count, "warmup", false);
+    const int failed = play(&session, events, count, "steady", true);
+    printf(failed ? "FAIL: %d steady state frames allocated\n" : "OK: steady state frames do not allocate\n", failed);
+
+    free(session.target.pixels);
+    layout_free(&session.layout);
+    cpu_tiler_free(&session.tiler);
+    if (argc > 2) input_trace_free(&trace);
+    else free(events);
+    thread_pool_destroy(&pool);
+    document_free(&doc);
+    return failed ? 1 : 0;
+}
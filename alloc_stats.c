@@ -0,0 +1,64 @@
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "alloc_stats.h"
+
+// glibc's own allocator, what the wrappers below forward to
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void __libc_free(void *p);
+
+struct stage_counters {
+    atomic_ulong allocs, reallocs, frees, bytes;
+};
+
+static struct stage_counters counters[ALLOC_MAX_STAGES];
+static atomic_int current_stage;
+
+static struct stage_counters *stage_counters(void) {
+    return &counters[atomic_load_explicit(&current_stage, memory_order_relaxed)];
+}
+
+static void add(atomic_ulong *counter, unsigned long value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+void alloc_stats_stage(int stage) {
+    atomic_store(&current_stage, stage > 0 && stage < ALLOC_MAX_STAGES ? stage : 0);
+}
+
+void alloc_stats_take(struct alloc_counts out[ALLOC_MAX_STAGES]) {
+    for (int i = 0; i < ALLOC_MAX_STAGES; i++) {
+        out[i].allocs = atomic_exchange(&counters[i].allocs, 0);
+        out[i].reallocs = atomic_exchange(&counters[i].reallocs, 0);
+        out[i].frees = atomic_exchange(&counters[i].frees, 0);
+        out[i].bytes = atomic_exchange(&counters[i].bytes, 0);
+    }
+}
+
+void *malloc(size_t size) {
+    struct stage_counters *stage = stage_counters();
+    add(&stage->allocs, 1);
+    add(&stage->bytes, size);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    struct stage_counters *stage = stage_counters();
+    add(&stage->allocs, 1);
+    add(&stage->bytes, count * size);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size) {
+    struct stage_counters *stage = stage_counters();
+    add(&stage->reallocs, 1);
+    add(&stage->bytes, size);
+    return __libc_realloc(p, size);
+}
+
+void free(void *p) {
+    if (p) add(&stage_counters()->frees, 1);
+    __libc_free(p);
+}
@@ -0,0 +1,23 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+
+#include <stdint.h>
+
+// counts every malloc, calloc, realloc and free of the process, attributed to the stage that is running
+// linking alloc_stats.c interposes the allocator, so it only goes into test builds like alloc_check
+// not together with -DARENA_DEBUG, which interposes the same functions
+#define ALLOC_MAX_STAGES 8 // stage 0 is everything outside a stage
+
+struct alloc_counts {
+    uint64_t allocs;   // malloc and calloc
+    uint64_t reallocs;
+    uint64_t frees;
+    uint64_t bytes;    // requested by allocs and reallocs
+};
+
+// what runs from now on, on any thread, is counted for stage
+void alloc_stats_stage(int stage);
+// copies the counts per stage into out and starts counting from zero
+void alloc_stats_take(struct alloc_counts out[ALLOC_MAX_STAGES]);
+
+#endif
@@ -0,0 +1,92 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+#include "tinycthread/tinycthread.h"
+
+bool arena_init(struct arena *arena, size_t reserved) {
+    *arena = (struct arena){0};
+    void *base = mmap(NULL, reserved, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) return false;
+    arena->base = base;
+    arena->reserved = reserved;
+    return true;
+}
+
+void arena_destroy(struct arena *arena) {
+    if (arena->base) munmap(arena->base, arena->reserved);
+    *arena = (struct arena){0};
+}
+
+void *arena_alloc(struct arena *arena, size_t size, size_t align) {
+    const size_t start = (arena->used + align - 1) & ~(align - 1);
+    if (start > arena->reserved || size > arena->reserved - start) return NULL;
+    arena->used = start + size;
+    if (arena->used > arena->high_water) arena->high_water = arena->used;
+    return arena->base + start;
+}
+
+static atomic_bool guard_armed;
+static tss_t guard_key; // guard depth of the calling thread
+static once_flag guard_once = ONCE_FLAG_INIT;
+
+static void guard_create_key(void) {
+    tss_create(&guard_key, NULL);
+}
+
+void arena_guard_arm(bool armed) {
+    call_once(&guard_once, guard_create_key);
+    atomic_store(&guard_armed, armed);
+}
+
+void arena_guard_begin(void) {
+    call_once(&guard_once, guard_create_key);
+    tss_set(guard_key, (void *) ((intptr_t) tss_get(guard_key) + 1));
+}
+
+void arena_guard_end(void) {
+    tss_set(guard_key, (void *) ((intptr_t) tss_get(guard_key) - 1));
+}
+
+bool arena_guard_active(void) {
+    call_once(&guard_once, guard_create_key);
+    return tss_get(guard_key) != NULL;
+}
+
+#ifdef ARENA_DEBUG
+// glibc's own allocator, what the wrappers below forward to
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+static void guard_check(const char *what) {
+    // arming creates the key first
+    if (!atomic_load_explicit(&guard_armed, memory_order_acquire) || !tss_get(guard_key)) return;
+    // no stdio, it may allocate itself
+    static const char message[] = "arena guard: allocation on the steady state frame path: ";
+    write(2, message, sizeof(message) - 1);
+    for (const char *c = what; *c; c++) write(2, c, 1);
+    write(2, "\n", 1);
+    abort();
+}
+
+void *malloc(size_t size) {
+    guard_check("malloc");
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    guard_check("calloc");
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *p, size_t size) {
+    guard_check("realloc");
+    return __libc_realloc(p, size);
+}
+#endif
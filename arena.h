@@ -0,0 +1,40 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// bump allocator for memory that lives for one frame
+// the whole capacity is reserved up front and only backed by pages as it is touched,
+// so an arena never moves, never copies on growth, and a reset is a single store
+//
+//     void *p = arena_alloc(&arena, size, 16);
+//     ...
+//     arena_reset(&arena); // at frame end, everything allocated since the last reset is gone
+
+struct arena {
+    char *base;
+    size_t used, reserved;
+    size_t high_water; // most ever used between two resets
+};
+
+// reserves address space only, reserved can be far larger than what a frame needs
+bool arena_init(struct arena *arena, size_t reserved);
+void arena_destroy(struct arena *arena);
+// align is a power of two, returns NULL once the reservation is used up
+void *arena_alloc(struct arena *arena, size_t size, size_t align);
+static inline void arena_reset(struct arena *arena) {
+    arena->used = 0;
+}
+
+// debug mode, build with -DARENA_DEBUG: malloc, calloc and realloc abort when they are called by a thread
+// inside a guarded stage while the guard is armed, so a steady state frame that allocates fails loudly
+// arm it once the app is warmed up, startup and resizes are expected to allocate
+// without ARENA_DEBUG the guard only keeps its counters and costs nothing on the allocation side
+void arena_guard_arm(bool armed);
+void arena_guard_begin(void);
+void arena_guard_end(void);
+// true inside a guarded stage on the calling thread, work it hands to other threads takes the guard along
+bool arena_guard_active(void);
+
+#endif
@@ -0,0 +1,397 @@
+// benchmarks the text pipeline stage by stage and prints the results as JSON, one object per benchmark
+// ./bench [document] [synthetic corpus size in MB] > results.json
+// every benchmark runs for at least BENCH_MIN_NS, so numbers are comparable between machines and versions
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "helper/util.h"
+#include "text.h"
+#include "glyph.h"
+#include "layout.h"
+#include "cpu_draw.h"
+#include "thread_pool.h"
+#include "shm_memory.h"
+
+#define BENCH_MIN_NS 200000000ull
+#define FRAME_WIDTH 1920
+#define FRAME_HEIGHT 1080
+#define LARGE_WIDTH 3840 // page size comparison runs at 4k, where a frame spans thousands of small pages
+#define LARGE_HEIGHT 2160
+#define CONTENTION_THREADS 32     // most threads of the scaling curve, which doubles from 1
+#define CONTENTION_CODEPOINTS 256 // each thread looks up CONTENTION_LOOKUPS of them, neighbours share half
+#define CONTENTION_LOOKUPS 128
+#define CONTENTION_SIZE 9         // sizes from here on are used by nothing else, one per thread count
+
+struct bench_result {
+    const char *name;
+    const char *corpus;
+    uint64_t ops;
+    uint64_t ns;
+    uint64_t bytes;  // per op, 0 if it does not apply
+    uint64_t pixels; // per op, 0 if it does not apply
+    const char *extra; // more JSON fields, NULL if none
+};
+
+typedef void (*bench_fn)(void *arg);
+
+static int result_count = 0;
+
+static void print_result(const struct bench_result *r) {
+    const double ns_per_op = (double) r->ns / r->ops;
+    printf("%s\n    {\"name\": \"%s\", \"corpus\": \"%s\", \"ops\": %lu, \"ns_per_op\": %.1f",
+           result_count++ ? "," : "", r->name, r->corpus, (unsigned long) r->ops, ns_per_op);
+    if (r->bytes) printf(", \"bytes_per_s\": %.0f", r->bytes * 1e9 / ns_per_op);
+    if (r->pixels) printf(", \"pixels_per_s\": %.0f", r->pixels * 1e9 / ns_per_op);
+    if (r->extra) printf(", %s", r->extra);
+    printf("}");
+    fflush(stdout);
+}
+
+// runs fn in doubling batches until BENCH_MIN_NS have passed
+static void measure(bench_fn fn, void *arg, struct bench_result *r) {
+    fn(arg); // warm up caches and the glyph atlas
+    for (uint64_t batch = 1; r->ns < BENCH_MIN_NS; batch *= 2) {
+        const uint64_t start = get_time_ns();
+        for (uint64_t i = 0; i < batch; i++) fn(arg);
+        r->ns += get_time_ns() - start;
+        r->ops += batch;
+    }
+}
+
+static void bench(const char *name, const char *corpus, bench_fn fn, void *arg, uint64_t bytes, uint64_t pixels) {
+    struct bench_result r = {name, corpus, 0, 0, bytes, pixels, NULL};
+    measure(fn, arg, &r);
+    print_result(&r);
+}
+
+// a document backed by memory instead of a file
+static void document_from_memory(struct document *doc, const char *data, size_t size) {
+    memset(doc, 0, sizeof(*doc));
+    doc->data = data;
+    doc->size = size;
+    doc->line_capacity = 1024;
+    doc->line_starts = malloc(doc->line_capacity * sizeof(size_t));
+    doc->line_starts[0] = 0;
+    doc->line_count = 1;
+    doc->generation = 1;
+}
+
+static void document_reset_index(struct document *doc) {
+    doc->line_count = 1;
+    doc->indexed = 0;
+}
+
+// synthetic corpora: code-like ascii lines, and text where most characters are multi-byte
+static char *make_corpus(size_t size, bool multibyte) {
+    static const char *words[] = {"int", "return", "struct", "layout", "glyph", "(x, y)", "{", "}", "==", "// note"};
+    static const char *wide[] = {"héllo", "wörld", "日本語", "текст", "✓", "λ→μ", "ünïcödé", "Ωmega"};
+    char *data = malloc(size);
+    uint32_t seed = 12345;
+    size_t i = 0;
+    int column = 0;
+    while (i < size) {
+        seed = seed * 1103515245 + 12345;
+        const char *word = multibyte ? wide[(seed >> 16) % 8] : words[(seed >> 16) % 10];
+        const size_t length = strlen(word);
+        if (i + length + 1 >= size) break;
+        memcpy(data + i, word, length);
+        i += length;
+        column += length;
+        data[i++] = column > 60 + (int) ((seed >> 8) % 40) ? '\n' : ' ';
+        if (data[i - 1] == '\n') column = 0;
+    }
+    memset(data + i, '\n', size - i);
+    return data;
+}
+
+struct text_arg {
+    struct document *doc;
+};
+
+static void bench_utf8_decode(void *arg) {
+    const struct document *doc = ((struct text_arg *) arg)->doc;
+    uint32_t sum = 0, codepoint;
+    for (size_t i = 0; i < doc->size;) {
+        i += utf8_decode(doc->data + i, doc->size - i, &codepoint);
+        sum += codepoint;
+    }
+    // keeps the loop from being optimized away
+    if (sum == 1) printf(" ");
+}
+
+static void bench_utf8_validate(void *arg) {
+    const struct document *doc = ((struct text_arg *) arg)->doc;
+    size_t errors = 0;
+    utf8_validate(doc->data, doc->size, &errors);
+    if (errors == SIZE_MAX) printf(" ");
+}
+
+static void bench_index_lines(void *arg) {
+    struct document *doc = ((struct text_arg *) arg)->doc;
+    document_reset_index(doc);
+    document_index_lines(doc, doc->size);
+}
+
+static void bench_glyph_rasterize(void *arg) {
+    (void) arg;
+    uint8_t out[16 * 16];
+    for (uint32_t c = 0x21; c < 0x7F; c++) glyph_rasterize(c, 16, out, 16);
+}
+
+struct draw_arg {
+    struct draw_list list;
+    struct cpu_target target;
+};
+
+static void bench_draw(void *arg) {
+    struct draw_arg *draw = arg;
+    cpu_draw_list(&draw->list, &draw->target);
+}
+
+// a screen full of 16 px glyph runs, no background, so only the blit is measured
+static uint64_t record_glyph_screen(struct draw_list *list, int width, int height) {
+    uint64_t pixels = 0;
+    dl_reset(list);
+    for (int y = 0; y + 16 <= height; y += 20) {
+        dl_glyphs_begin(list, 0, y, 0xFFD4D4D4);
+        for (int x = 0; x + 16 <= width; x += 16) {
+            dl_glyph(list, glyph_lookup(0x21 + (x / 16 + y) % 94, 16), x);
+            pixels += 16 * 16;
+        }
+    }
+    dl_finish(list);
+    glyph_commit();
+    return pixels;
+}
+
+// overlapping translucent and opaque rects
+static uint64_t record_rects(struct draw_list *list) {
+    uint64_t pixels = 0;
+    dl_reset(list);
+    for (int i = 0; i < 64; i++) {
+        const int x = (i * 97) % (FRAME_WIDTH - 256), y = (i * 61) % (FRAME_HEIGHT - 256);
+        dl_rect(list, x, y, 256, 256, i & 1 ? 0x80336699 : 0xFF996633);
+        pixels += 256 * 256;
+    }
+    dl_finish(list);
+    return pixels;
+}
+
+struct frame_arg {
+    struct document *doc;
+    struct layout layout;
+    struct cpu_target target;
+    struct thread_pool *pool; // NULL for the serial replay
+    struct cpu_tiler tiler;
+    size_t first_line;
+};
+
+// scrolls one line per frame, so every frame pays for a new layout and a full replay
+static void bench_frame(void *arg) {
+    struct frame_arg *frame = arg;
+    const struct view view = {.first_line = frame->first_line, .width = FRAME_WIDTH, .height = FRAME_HEIGHT,
+                              .font_size = 16, .background = 0xFF1E1E1E, .foreground = 0xFFD4D4D4};
+    frame->first_line = (frame->first_line + 1) % (frame->doc->line_count > 100 ? frame->doc->line_count - 100 : 1);
+    layout_update(&frame->layout, frame->doc, &view);
+    if (frame->pool) cpu_draw_list_parallel(&frame->tiler, frame->pool, &frame->layout.list, &frame->target);
+    else cpu_draw_list(&frame->layout.list, &frame->target);
+}
+
+struct contention_arg {
+    struct thread_pool *pool; // NULL for a single thread
+    int threads;
+    int size_px;
+    uint32_t ids[CONTENTION_THREADS][CONTENTION_LOOKUPS];
+};
+
+// which of the shared codepoints lookup i of thread t is, at 32 threads every codepoint is looked up by 16
+static int contention_index(int t, int i) {
+    return (t * CONTENTION_LOOKUPS / 2 + i) % CONTENTION_CODEPOINTS;
+}
+
+static void contention_lookups(void *arg, int begin, int end) {
+    struct contention_arg *contention = arg;
+    for (int t = begin; t < end; t++) {
+        for (int i = 0; i < CONTENTION_LOOKUPS; i++)
+            contention->ids[t][i] = glyph_lookup(0x100 + contention_index(t, i), contention->size_px);
+    }
+}
+
+static void bench_contention(void *arg) {
+    struct contention_arg *contention = arg;
+    if (contention->pool) parallel_for(contention->pool, 0, contention->threads, 1, contention_lookups, contention);
+    else contention_lookups(contention, 0, contention->threads);
+}
+
+// every thread has to get the same id for a codepoint, and no two codepoints may share one
+static bool contention_ids_valid(const struct contention_arg *contention) {
+    uint32_t id_of[CONTENTION_CODEPOINTS];
+    static bool used[GLYPH_MAX];
+    memset(used, 0, sizeof(used));
+    for (int k = 0; k < CONTENTION_CODEPOINTS; k++) id_of[k] = GLYPH_MAX;
+    for (int t = 0; t < contention->threads; t++) {
+        for (int i = 0; i < CONTENTION_LOOKUPS; i++) {
+            const uint32_t id = contention->ids[t][i];
+            const int k = contention_index(t, i);
+            if (id == GLYPH_SOLID || id >= GLYPH_MAX) return false;
+            if (id_of[k] == id) continue;
+            if (id_of[k] != GLYPH_MAX || used[id]) return false;
+            id_of[k] = id;
+            used[id] = true;
+        }
+    }
+    return true;
+}
+
+struct glyph_counts {
+    unsigned long hits, misses, pending_waits, cas_failures;
+};
+
+static struct glyph_counts glyph_counts_now(void) {
+    return (struct glyph_counts){atomic_load(&glyph_cache_stats.hits), atomic_load(&glyph_cache_stats.misses),
+                                 atomic_load(&glyph_cache_stats.pending_waits),
+                                 atomic_load(&glyph_cache_stats.cas_failures)};
+}
+
+// lookup throughput and the cache counters of a pass as JSON fields, the throughput is what should scale
+static void contention_json(char *out, size_t size, const struct bench_result *r, int threads,
+                            struct glyph_counts before) {
+    const struct glyph_counts after = glyph_counts_now();
+    snprintf(out, size,
+             "\"threads\": %d, \"lookups_per_s\": %.0f, \"hits\": %lu, \"misses\": %lu, \"pending_waits\": %lu, "
+             "\"cas_failures\": %lu",
+             threads, (double) threads * CONTENTION_LOOKUPS * r->ops * 1e9 / r->ns, after.hits - before.hits,
+             after.misses - before.misses,
+             after.pending_waits - before.pending_waits, after.cas_failures - before.cas_failures);
+}
+
+// 1 to 32 threads look up overlapping glyph sets, each count at a size of its own
+// glyph_contention_cold is one pass on a cold cache, where the threads race for the same slots and wait on
+// each other's rasterization, glyph_contention the hits after the commit, which have to hand out the same ids again
+// returns false if any pass got a wrong id
+static bool bench_glyph_contention(void) {
+    struct contention_arg *contention = calloc(1, sizeof(*contention));
+    uint32_t (*cold)[CONTENTION_LOOKUPS] = malloc(sizeof(contention->ids));
+    bool valid = true;
+    for (int threads = 1, step = 0; threads <= CONTENTION_THREADS; threads *= 2, step++) {
+        struct thread_pool pool;
+        if (threads > 1) thread_pool_init(&pool, threads - 1);
+        contention->pool = threads > 1 ? &pool : NULL;
+        contention->threads = threads;
+        contention->size_px = CONTENTION_SIZE + step;
+        char corpus[64], counts[256];
+        snprintf(corpus, sizeof(corpus), "%d_threads_%dpx", threads, contention->size_px);
+
+        struct glyph_counts before = glyph_counts_now();
+        struct bench_result r = {"glyph_contention_cold", corpus, 1, 0, 0, 0, counts};
+        const uint64_t start = get_time_ns();
+        bench_contention(contention);
+        r.ns = get_time_ns() - start;
+        contention_json(counts, sizeof(counts), &r, threads, before);
+        print_result(&r);
+        const bool cold_valid = contention_ids_valid(contention);
+        glyph_commit();
+        memcpy(cold, contention->ids, sizeof(contention->ids));
+
+        before = glyph_counts_now();
+        r = (struct bench_result){"glyph_contention", corpus, 0, 0, 0, 0, counts};
+        measure(bench_contention, contention, &r);
+        contention_json(counts, sizeof(counts), &r, threads, before);
+        print_result(&r);
+        if (!cold_valid || !contention_ids_valid(contention) || memcmp(cold, contention->ids, sizeof(contention->ids))) {
+            fprintf(stderr, "glyph_contention: %d threads got different or duplicate glyph ids\n", threads);
+            valid = false;
+        }
+        if (threads > 1) thread_pool_destroy(&pool);
+    }
+    free(cold);
+    free(contention);
+    return valid;
+}
+
+// the same blits into wl_shm style memory with each kind of page the system offers
+static void bench_pages(void) {
+    const size_t size = (size_t) LARGE_WIDTH * LARGE_HEIGHT * 4;
+    const uint64_t frame_pixels = (uint64_t) LARGE_WIDTH * LARGE_HEIGHT;
+    struct draw_arg draw = {0};
+    for (enum shm_pages pages = SHM_PAGES_SMALL; pages <= SHM_PAGES_HUGETLB; pages++) {
+        struct shm_memory memory;
+        if (!shm_memory_create(&memory, "bench", size, pages)) continue;
+        if (memory.pages != pages) {
+            fprintf(stderr, "%s pages not available, skipped\n", shm_pages_name(pages));
+            shm_memory_destroy(&memory);
+            continue;
+        }
+        char corpus[64];
+        snprintf(corpus, sizeof(corpus), "4k_%s_pages", shm_pages_name(pages));
+        for (char *c = corpus; *c; c++) if (*c == ' ') *c = '_';
+        draw.target = (struct cpu_target){(uint32_t *) memory.data, LARGE_WIDTH, LARGE_HEIGHT, LARGE_WIDTH};
+        const uint64_t glyph_pixels = record_glyph_screen(&draw.list, LARGE_WIDTH, LARGE_HEIGHT);
+        bench("glyph_blit", corpus, bench_draw, &draw, 0, glyph_pixels);
+        dl_reset(&draw.list);
+        dl_rect(&draw.list, 0, 0, LARGE_WIDTH, LARGE_HEIGHT, 0xFF1E1E1E);
+        dl_finish(&draw.list);
+        bench("frame_fill", corpus, bench_draw, &draw, 0, frame_pixels);
+        shm_memory_destroy(&memory);
+    }
+    dl_free(&draw.list);
+}
+
+static void bench_corpus(const char *corpus, struct document *doc, struct thread_pool *pool, uint32_t *pixels) {
+    struct text_arg text = {doc};
+    bench("utf8_decode", corpus, bench_utf8_decode, &text, doc->size, 0);
+    bench("utf8_validate", corpus, bench_utf8_validate, &text, doc->size, 0);
+    bench("index_lines", corpus, bench_index_lines, &text, doc->size, 0);
+    const struct cpu_target target = {pixels, FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH};
+    const uint64_t frame_pixels = (uint64_t) FRAME_WIDTH * FRAME_HEIGHT;
+    struct frame_arg serial = {.doc = doc, .target = target};
+    bench("frame_layout_render", corpus, bench_frame, &serial, 0, frame_pixels);
+    struct frame_arg parallel = {.doc = doc, .target = target, .pool = pool};
+    bench("frame_layout_render_parallel", corpus, bench_frame, &parallel, 0, frame_pixels);
+    layout_free(&serial.layout);
+    layout_free(&parallel.layout);
+    cpu_tiler_free(&parallel.tiler);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "example_text.txt";
+    const size_t corpus_size = (argc > 2 ? atoi(argv[2]) : 32) << 20;
+    struct document doc;
+    if (!document_load(&doc, path)) return 1;
+    document_index_lines(&doc, doc.size);
+    struct thread_pool pool;
+    thread_pool_init(&pool, 0);
+    uint32_t *pixels = calloc((size_t) FRAME_WIDTH * FRAME_HEIGHT, 4);
+
+    printf("{\"threads\": %d, \"frame\": [%d, %d], \"results\": [", pool.worker_count + 1, FRAME_WIDTH, FRAME_HEIGHT);
+    bench("glyph_rasterize", "ascii_16px", bench_glyph_rasterize, NULL, 0, 94 * 16 * 16);
+    struct draw_arg draw = {{0}, {pixels, FRAME_WIDTH, FRAME_HEIGHT, FRAME_WIDTH}};
+    const uint64_t glyph_pixels = record_glyph_screen(&draw.list, FRAME_WIDTH, FRAME_HEIGHT);
+    bench("glyph_blit", "screen_16px", bench_draw, &draw, 0, glyph_pixels);
+    const uint64_t rect_pixels = record_rects(&draw.list);
+    bench("rect_fill", "64_rects_256px", bench_draw, &draw, 0, rect_pixels);
+    dl_free(&draw.list);
+    const bool glyph_ids_valid = bench_glyph_contention();
+    bench_pages();
+
+    bench_corpus(path, &doc, &pool, pixels);
+    const char *names[] = {"synthetic_ascii", "synthetic_multibyte"};
+    for (int i = 0; i < 2; i++) {
+        char *data = make_corpus(corpus_size, i == 1);
+        struct document synthetic;
+        document_from_memory(&synthetic, data, corpus_size);
+        document_index_lines(&synthetic, synthetic.size);
+        bench_corpus(names[i], &synthetic, &pool, pixels);
+        free(synthetic.line_starts);
+        free(data);
+    }
+    printf("\n]}\n");
+
+    free(pixels);
+    document_free(&doc);
+    thread_pool_destroy(&pool);
+    return glyph_ids_valid ? 0 : 1;
+}
@@ -1 +1,246 @@
+#include <stddef.h>
 
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "cpu_draw.h"
+#include "arena.h"
+#include "glyph.h"
+#include "trace.h"
+
+struct cpu_clip { int x0, y0, x1, y1; };
+
+static inline struct cpu_clip clip_intersect(struct cpu_clip a, struct cpu_clip b) {
+    if (b.x0 > a.x0) a.x0 = b.x0;
+    if (b.y0 > a.y0) a.y0 = b.y0;
+    if (b.x1 < a.x1) a.x1 = b.x1;
+    if (b.y1 < a.y1) a.y1 = b.y1;
+    return a;
+}
+
+// (a * b) / 255 rounded, exact for 8 bit inputs
+static inline uint32_t mul255(uint32_t a, uint32_t b) {
+    const uint32_t t = a * b + 128;
+    return (t + (t >> 8)) >> 8;
+}
+
+static inline uint32_t blend(uint32_t dst, uint32_t color, uint32_t alpha) {
+    const uint32_t inv = 255 - alpha;
+    const uint32_t r = mul255((color >> 16) & 0xFF, alpha) + mul255((dst >> 16) & 0xFF, inv);
+    const uint32_t g = mul255((color >> 8) & 0xFF, alpha) + mul255((dst >> 8) & 0xFF, inv);
+    const uint32_t b = mul255(color & 0xFF, alpha) + mul255(dst & 0xFF, inv);
+    const uint32_t a = alpha + mul255(dst >> 24, inv);
+    return a << 24 | r << 16 | g << 8 | b;
+}
+
+static void fill_rect(const struct cpu_target *target, struct cpu_clip clip, const struct dl_rect *rect) {
+    const struct cpu_clip r = clip_intersect(clip, (struct cpu_clip){rect->x, rect->y, rect->x + rect->w, rect->y + rect->h});
+    const uint32_t alpha = rect->color >> 24;
+    for (int y = r.y0; y < r.y1; y++) {
+        uint32_t *row = target->pixels + (size_t) y * target->stride;
+        if (alpha == 0xFF) {
+            for (int x = r.x0; x < r.x1; x++) row[x] = rect->color;
+        } else {
+            for (int x = r.x0; x < r.x1; x++) row[x] = blend(row[x], rect->color, alpha);
+        }
+    }
+}
+
+static void draw_glyphs(const struct cpu_target *target, struct cpu_clip clip, const struct dl_glyphs *run, int first, int count) {
+    const uint32_t color_alpha = run->color >> 24;
+    for (int i = first; i < first + count; i++) {
+        const struct glyph *glyph = &glyphs[run->glyphs[i].id];
+        const int gx = run->x + run->glyphs[i].x;
+        const int gy = run->y;
+        const struct cpu_clip r = clip_intersect(clip, (struct cpu_clip){gx, gy, gx + glyph->w, gy + glyph->h});
+        for (int y = r.y0; y < r.y1; y++) {
+            uint32_t *row = target->pixels + (size_t) y * target->stride;
+            const uint8_t *coverage = &glyph_atlas.pixels[(glyph->atlas_y + y - gy) * GLYPH_ATLAS_SIZE + glyph->atlas_x - gx];
+            for (int x = r.x0; x < r.x1; x++) {
+                const uint32_t c = coverage[x];
+                if (c == 0) continue;
+                row[x] = blend(row[x], run->color, mul255(c, color_alpha));
+            }
+        }
+    }
+}
+
+void cpu_draw_region(const struct draw_list *list, const struct cpu_target *target, int x0, int y0, int x1, int y1) {
+    const struct cpu_clip region = clip_intersect((struct cpu_clip){0, 0, target->width, target->height}, (struct cpu_clip){x0, y0, x1, y1});
+    struct cpu_clip clip = region;
+    uint32_t it = 0;
+    struct dl_cmd cmd;
+    while (dl_next(list, &it, &cmd)) {
+        switch (cmd.op) {
+        case DL_RECT:
+            fill_rect(target, clip, &cmd.rect);
+            break;
+        case DL_GLYPHS:
+            draw_glyphs(target, clip, &cmd.glyphs, 0, cmd.glyphs.count);
+            break;
+        case DL_CLIP:
+            clip = cmd.rect.w == 0 ? region
+                 : clip_intersect(region, (struct cpu_clip){cmd.rect.x, cmd.rect.y, cmd.rect.x + cmd.rect.w, cmd.rect.y + cmd.rect.h});
+            break;
+        }
+    }
+}
+
+void cpu_draw_list(const struct draw_list *list, const struct cpu_target *target) {
+    cpu_draw_region(list, target, 0, 0, target->width, target->height);
+}
+
+// tiled rendering: bin every command (and every glyph of a run) into the tiles it touches, then render tiles in parallel
+// a tile only ever writes its own pixels, so workers need no locks
+
+struct cpu_bin_entry {
+    uint32_t tile;
+    uint32_t cmd;          // offset of the command in the draw list
+    uint16_t first, count; // glyph range for DL_GLYPHS
+    uint32_t clip;         // index into tiler->clips
+};
+
+static void *grow(void *data, size_t *capacity, size_t needed, size_t item_size) {
+    if (needed <= *capacity) return data;
+    size_t new_capacity = *capacity ? *capacity : 1024;
+    while (new_capacity < needed) new_capacity *= 2;
+    data = realloc(data, new_capacity * item_size);
+    if (!data) {
+        fprintf(stderr, "Failed to grow tile bins to %zu entries\n", new_capacity);
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return data;
+}
+
+static void bin_add(struct cpu_tiler *tiler, struct cpu_clip box, uint32_t cmd, int glyph, uint32_t clip) {
+    const int tx0 = box.x0 / CPU_TILE_SIZE, ty0 = box.y0 / CPU_TILE_SIZE;
+    const int tx1 = (box.x1 - 1) / CPU_TILE_SIZE, ty1 = (box.y1 - 1) / CPU_TILE_SIZE;
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            const uint32_t tile = ty * tiler->tiles_x + tx;
+            // consecutive glyphs of one run landing in the same tile share an entry
+            const uint32_t last = tiler->last_entry[tile];
+            if (last != UINT32_MAX) {
+                struct cpu_bin_entry *entry = &tiler->unsorted[last];
+                if (entry->cmd == cmd && entry->first + entry->count == glyph && entry->count < UINT16_MAX) {
+                    entry->count++;
+                    continue;
+                }
+            }
+            tiler->unsorted = grow(tiler->unsorted, &tiler->entry_capacity, tiler->entry_count + 1, sizeof(struct cpu_bin_entry));
+            tiler->last_entry[tile] = tiler->entry_count;
+            tiler->unsorted[tiler->entry_count++] = (struct cpu_bin_entry){tile, cmd, glyph, 1, clip};
+        }
+    }
+}
+
+static void bin_list(struct cpu_tiler *tiler, const struct draw_list *list) {
+    const struct cpu_clip screen = {0, 0, tiler->width, tiler->height};
+    tiler->entry_count = 0;
+    tiler->clip_count = 0;
+    tiler->clips = grow(tiler->clips, &tiler->clip_capacity, 1, sizeof(struct cpu_clip));
+    tiler->clips[tiler->clip_count++] = screen;
+    uint32_t clip_index = 0;
+    for (int i = 0; i < tiler->tiles_x * tiler->tiles_y; i++) tiler->last_entry[i] = UINT32_MAX;
+    uint32_t it = 0;
+    struct dl_cmd cmd;
+    for (uint32_t offset = 0; dl_next(list, &it, &cmd); offset = it) {
+        const struct cpu_clip clip = tiler->clips[clip_index];
+        switch (cmd.op) {
+        case DL_RECT: {
+            const struct dl_rect *r = &cmd.rect;
+            const struct cpu_clip box = clip_intersect(clip, (struct cpu_clip){r->x, r->y, r->x + r->w, r->y + r->h});
+            if (box.x1 > box.x0 && box.y1 > box.y0) bin_add(tiler, box, offset, 0, clip_index);
+            break;
+        }
+        case DL_GLYPHS:
+            for (int g = 0; g < cmd.glyphs.count; g++) {
+                const struct glyph *glyph = &glyphs[cmd.glyphs.glyphs[g].id];
+                const int gx = cmd.glyphs.x + cmd.glyphs.glyphs[g].x, gy = cmd.glyphs.y;
+                const struct cpu_clip box = clip_intersect(clip, (struct cpu_clip){gx, gy, gx + glyph->w, gy + glyph->h});
+                if (box.x1 > box.x0 && box.y1 > box.y0) bin_add(tiler, box, offset, g, clip_index);
+            }
+            break;
+        case DL_CLIP:
+            tiler->clips = grow(tiler->clips, &tiler->clip_capacity, tiler->clip_count + 1, sizeof(struct cpu_clip));
+            tiler->clips[tiler->clip_count] = cmd.rect.w == 0 ? screen
+                : clip_intersect(screen, (struct cpu_clip){cmd.rect.x, cmd.rect.y, cmd.rect.x + cmd.rect.w, cmd.rect.y + cmd.rect.h});
+            clip_index = tiler->clip_count++;
+            break;
+        }
+    }
+    // stable counting sort by tile, keeps the draw order within every tile
+    const int tiles = tiler->tiles_x * tiler->tiles_y;
+    for (int i = 0; i <= tiles; i++) tiler->bin_start[i] = 0;
+    for (size_t i = 0; i < tiler->entry_count; i++) tiler->bin_start[tiler->unsorted[i].tile + 1]++;
+    for (int i = 0; i < tiles; i++) tiler->bin_start[i + 1] += tiler->bin_start[i];
+    size_t sorted_capacity = tiler->entry_capacity;
+    tiler->entries = grow(tiler->entries, &tiler->sorted_capacity, sorted_capacity, sizeof(struct cpu_bin_entry));
+    for (int i = 0; i < tiles; i++) tiler->last_entry[i] = tiler->bin_start[i]; // reused as fill cursor
+    for (size_t i = 0; i < tiler->entry_count; i++) {
+        tiler->entries[tiler->last_entry[tiler->unsorted[i].tile]++] = tiler->unsorted[i];
+    }
+}
+
+struct tile_job {
+    struct cpu_tiler *tiler;
+    const struct draw_list *list;
+    const struct cpu_target *target;
+    bool guarded; // the caller is in a guarded stage, the workers rendering its tiles are too
+};
+
+static void render_tiles(void *data, int begin, int end) {
+    const uint64_t zone = trace_begin();
+    const struct tile_job *job = data;
+    if (job->guarded) arena_guard_begin();
+    const struct cpu_tiler *tiler = job->tiler;
+    for (int tile = begin; tile < end; tile++) {
+        const int tx = tile % tiler->tiles_x, ty = tile / tiler->tiles_x;
+        const struct cpu_clip bounds = clip_intersect((struct cpu_clip){0, 0, tiler->width, tiler->height},
+            (struct cpu_clip){tx * CPU_TILE_SIZE, ty * CPU_TILE_SIZE, (tx + 1) * CPU_TILE_SIZE, (ty + 1) * CPU_TILE_SIZE});
+        for (uint32_t i = tiler->bin_start[tile]; i < tiler->bin_start[tile + 1]; i++) {
+            const struct cpu_bin_entry *entry = &tiler->entries[i];
+            const struct cpu_clip clip = clip_intersect(bounds, tiler->clips[entry->clip]);
+            uint32_t it = entry->cmd;
+            struct dl_cmd cmd;
+            dl_next(job->list, &it, &cmd);
+            if (cmd.op == DL_RECT) fill_rect(job->target, clip, &cmd.rect);
+            else draw_glyphs(job->target, clip, &cmd.glyphs, entry->first, entry->count);
+        }
+    }
+    if (job->guarded) arena_guard_end();
+    trace_end("tiles", zone);
+}
+
+void cpu_draw_list_parallel(struct cpu_tiler *tiler, struct thread_pool *pool,
+                            const struct draw_list *list, const struct cpu_target *target) {
+    const int tiles_x = (target->width + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+    const int tiles_y = (target->height + CPU_TILE_SIZE - 1) / CPU_TILE_SIZE;
+    if (tiles_x * tiles_y > tiler->tile_capacity) {
+        tiler->tile_capacity = tiles_x * tiles_y;
+        free(tiler->bin_start);
+        free(tiler->last_entry);
+        tiler->bin_start = malloc((tiler->tile_capacity + 1) * sizeof(uint32_t));
+        tiler->last_entry = malloc(tiler->tile_capacity * sizeof(uint32_t));
+    }
+    tiler->tiles_x = tiles_x;
+    tiler->tiles_y = tiles_y;
+    tiler->width = target->width;
+    tiler->height = target->height;
+    const uint64_t zone = trace_begin();
+    bin_list(tiler, list);
+    trace_end("bin", zone);
+    struct tile_job job = {tiler, list, target, arena_guard_active()};
+    // a handful of tiles per chunk keeps the scheduling overhead low while leaving enough chunks to balance
+    parallel_for(pool, 0, tiles_x * tiles_y, 4, render_tiles, &job);
+}
+
+void cpu_tiler_free(struct cpu_tiler *tiler) {
+    free(tiler->bin_start);
+    free(tiler->last_entry);
+    free(tiler->unsorted);
+    free(tiler->entries);
+    free(tiler->clips);
+    *tiler = (struct cpu_tiler){0};
+}
@@ -0,0 +1,43 @@
+#ifndef CPU_DRAW_H
+#define CPU_DRAW_H
+
+#include <stdint.h>
+
+#include "draw_list.h"
+#include "thread_pool.h"
+
+// ARGB8888 frame buffer, stride in pixels
+struct cpu_target {
+    uint32_t *pixels;
+    int width, height, stride;
+};
+
+// replays the draw list into the target
+void cpu_draw_list(const struct draw_list *list, const struct cpu_target *target);
+// same, but only touches pixels inside [x0, x1) x [y0, y1)
+void cpu_draw_region(const struct draw_list *list, const struct cpu_target *target, int x0, int y0, int x1, int y1);
+
+// tiled parallel replay, see cpu_draw_list_parallel
+#define CPU_TILE_SIZE 64
+
+struct cpu_bin_entry;
+struct cpu_clip;
+
+// binning state, kept between frames so steady state rendering does not allocate
+struct cpu_tiler {
+    int width, height, tiles_x, tiles_y, tile_capacity;
+    uint32_t *bin_start;  // tiles + 1 offsets into entries
+    uint32_t *last_entry; // per tile, last entry appended while binning
+    struct cpu_bin_entry *unsorted, *entries;
+    size_t entry_count, entry_capacity, sorted_capacity;
+    struct cpu_clip *clips;
+    size_t clip_count, clip_capacity;
+};
+
+// splits the target into CPU_TILE_SIZE tiles, bins the commands into the tiles they touch
+// and renders the tiles on the pool, produces the same pixels as cpu_draw_list
+void cpu_draw_list_parallel(struct cpu_tiler *tiler, struct thread_pool *pool,
+                            const struct draw_list *list, const struct cpu_target *target);
+void cpu_tiler_free(struct cpu_tiler *tiler);
+
+#endif
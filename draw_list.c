@@ -0,0 +1,179 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "draw_list.h"
+
+// every command starts with a 4 byte header: op in the low byte, glyph count in the high 16 bits
+// payloads keep 4 byte alignment so glyph arrays can be read in place
+struct dl_header {
+    uint8_t op;
+    uint8_t pad;
+    uint16_t count;
+};
+struct dl_rect_payload {
+    int16_t x, y, w, h;
+    uint32_t color;
+};
+struct dl_glyphs_payload {
+    int16_t x, y;
+    uint32_t color;
+};
+
+static void *dl_push(struct draw_list *list, uint32_t size) {
+    if (list->size + size > list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 4096;
+        while (capacity < list->size + size) capacity *= 2;
+        uint8_t *data = realloc(list->data, capacity);
+        if (!data) {
+            fprintf(stderr, "Failed to grow draw list to %u bytes\n", capacity);
+            exit(1);
+        }
+        list->data = data;
+        list->capacity = capacity;
+    }
+    void *p = list->data + list->size;
+    list->size += size;
+    return p;
+}
+
+static void dl_close_run(struct draw_list *list) {
+    if (list->run == DL_NO_RUN || list->run >= list->size) {
+        list->run = DL_NO_RUN;
+        return;
+    }
+    struct dl_header *header = (struct dl_header *) (list->data + list->run);
+    if (header->count == 0) list->size = list->run; // drop empty runs
+    else list->cmd_count++;
+    list->run = DL_NO_RUN;
+}
+
+void dl_reset(struct draw_list *list) {
+    list->size = 0;
+    list->cmd_count = 0;
+    list->glyph_count = 0;
+    list->run = DL_NO_RUN;
+}
+
+void dl_free(struct draw_list *list) {
+    free(list->data);
+    memset(list, 0, sizeof(*list));
+}
+
+static void dl_push_rect(struct draw_list *list, enum dl_op op, int x, int y, int w, int h, uint32_t color) {
+    dl_close_run(list);
+    struct dl_header *header = dl_push(list, sizeof(struct dl_header) + sizeof(struct dl_rect_payload));
+    *header = (struct dl_header){.op = op};
+    struct dl_rect_payload *rect = (struct dl_rect_payload *) (header + 1);
+    *rect = (struct dl_rect_payload){x, y, w, h, color};
+    list->cmd_count++;
+}
+
+void dl_rect(struct draw_list *list, int x, int y, int w, int h, uint32_t color) {
+    if (w <= 0 || h <= 0) return;
+    dl_push_rect(list, DL_RECT, x, y, w, h, color);
+}
+
+void dl_clip(struct draw_list *list, int x, int y, int w, int h) {
+    dl_push_rect(list, DL_CLIP, x, y, w, h, 0);
+}
+
+void dl_glyphs_begin(struct draw_list *list, int x, int y, uint32_t color) {
+    dl_close_run(list);
+    list->run = list->size;
+    struct dl_header *header = dl_push(list, sizeof(struct dl_header) + sizeof(struct dl_glyphs_payload));
+    *header = (struct dl_header){.op = DL_GLYPHS};
+    struct dl_glyphs_payload *run = (struct dl_glyphs_payload *) (header + 1);
+    *run = (struct dl_glyphs_payload){x, y, color};
+}
+
+void dl_glyph(struct draw_list *list, uint32_t id, int x) {
+    if (list->run == DL_NO_RUN || list->run >= list->size) return;
+    if (((struct dl_header *) (list->data + list->run))->count == UINT16_MAX) {
+        // start a continuation run at the same origin
+        const struct dl_glyphs_payload run = *(struct dl_glyphs_payload *) (list->data + list->run + sizeof(struct dl_header));
+        dl_glyphs_begin(list, run.x, run.y, run.color);
+    }
+    struct dl_glyph *glyph = dl_push(list, sizeof(struct dl_glyph));
+    *glyph = (struct dl_glyph){.id = id, .x = x};
+    // data may have moved in dl_push
+    ((struct dl_header *) (list->data + list->run))->count++;
+    list->glyph_count++;
+}
+
+uint32_t dl_mark(struct draw_list *list) {
+    dl_close_run(list);
+    return list->size;
+}
+
+// makes room for size bytes, without counting them as used
+static void dl_reserve(struct draw_list *list, uint32_t size) {
+    const uint32_t used = list->size;
+    dl_push(list, size);
+    list->size = used;
+}
+
+void dl_splice(struct draw_list *list, uint32_t begin, uint32_t end, const struct draw_list *insert) {
+    dl_close_run(list);
+    struct dl_cmd cmd;
+    for (uint32_t it = begin; it < end && dl_next(list, &it, &cmd);) {
+        list->cmd_count--;
+        if (cmd.op == DL_GLYPHS) list->glyph_count -= cmd.glyphs.count;
+    }
+    if (insert->size > end - begin) dl_reserve(list, insert->size - (end - begin));
+    memmove(list->data + begin + insert->size, list->data + end, list->size - end);
+    memcpy(list->data + begin, insert->data, insert->size);
+    list->size = list->size - (end - begin) + insert->size;
+    list->cmd_count += insert->cmd_count;
+    list->glyph_count += insert->glyph_count;
+}
+
+void dl_copy(struct draw_list *dst, const struct draw_list *src) {
+    dl_reset(dst);
+    dl_reserve(dst, src->size);
+    memcpy(dst->data, src->data, src->size);
+    dst->size = src->size;
+    dst->cmd_count = src->cmd_count;
+    dst->glyph_count = src->glyph_count;
+    dst->run = src->run;
+    dst->hash = src->hash;
+    dst->generation = src->generation;
+}
+
+// FNV-1a, only used to detect that a list did not change
+static uint64_t dl_hash(const uint8_t *data, uint32_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool dl_finish(struct draw_list *list) {
+    dl_close_run(list);
+    const uint64_t hash = dl_hash(list->data, list->size);
+    if (list->generation && hash == list->hash) return false;
+    list->hash = hash;
+    list->generation++;
+    return true;
+}
+
+bool dl_next(const struct draw_list *list, uint32_t *it, struct dl_cmd *cmd) {
+    if (*it >= list->size) return false;
+    const uint8_t *p = list->data + *it;
+    const struct dl_header *header = (const struct dl_header *) p;
+    p += sizeof(struct dl_header);
+    cmd->op = header->op;
+    if (header->op == DL_GLYPHS) {
+        const struct dl_glyphs_payload *run = (const struct dl_glyphs_payload *) p;
+        cmd->glyphs = (struct dl_glyphs){run->x, run->y, header->count, run->color,
+                                         (const struct dl_glyph *) (run + 1)};
+        *it += sizeof(struct dl_header) + sizeof(struct dl_glyphs_payload) + header->count * sizeof(struct dl_glyph);
+    } else {
+        const struct dl_rect_payload *rect = (const struct dl_rect_payload *) p;
+        cmd->rect = (struct dl_rect){rect->x, rect->y, rect->w, rect->h, rect->color};
+        *it += sizeof(struct dl_header) + sizeof(struct dl_rect_payload);
+    }
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// backend-neutral list of draw commands, recorded by layout and replayed by cpu_draw.c or egl.c
+// commands are packed back to back in one byte array, so a list is cheap to keep around and to replay
+enum dl_op {
+    DL_RECT = 1,   // solid rectangle
+    DL_GLYPHS = 2, // run of glyphs from the glyph atlas, all in one color
+    DL_CLIP = 3,   // clip rect for all following commands, w == 0 resets to the full target
+};
+
+struct dl_rect {
+    int16_t x, y, w, h;
+    uint32_t color; // ARGB8888
+};
+
+struct dl_glyph {
+    uint32_t id; // glyph id from glyph.h
+    int16_t x;   // pen position relative to the run
+    uint16_t pad; // named so it is zeroed, lists are hashed byte by byte
+};
+
+struct dl_glyphs {
+    int16_t x, y; // top left of the run
+    uint16_t count;
+    uint32_t color;
+    const struct dl_glyph *glyphs; // points into the list, valid as long as the list is
+};
+
+struct dl_cmd {
+    enum dl_op op;
+    union {
+        struct dl_rect rect; // DL_RECT and DL_CLIP
+        struct dl_glyphs glyphs;
+    };
+};
+
+#define DL_NO_RUN UINT32_MAX
+
+struct draw_list {
+    uint8_t *data;
+    uint32_t size, capacity;
+    uint32_t cmd_count;
+    uint32_t glyph_count;
+    uint32_t run;        // offset of the glyph run being recorded, DL_NO_RUN if none
+    uint64_t hash;       // content hash, set by dl_finish
+    uint32_t generation; // bumped by every dl_finish that changed the content
+};
+
+void dl_reset(struct draw_list *list);
+void dl_free(struct draw_list *list);
+void dl_rect(struct draw_list *list, int x, int y, int w, int h, uint32_t color);
+void dl_clip(struct draw_list *list, int x, int y, int w, int h);
+// glyph runs are recorded as begin + one call per glyph, the run is closed by the next command or dl_finish
+void dl_glyphs_begin(struct draw_list *list, int x, int y, uint32_t color);
+void dl_glyph(struct draw_list *list, uint32_t id, int x);
+// closes the run being recorded and returns the current end of the list, a position for dl_splice
+uint32_t dl_mark(struct draw_list *list);
+// replaces the commands in [begin, end) with all of insert, which must be closed (dl_mark or dl_finish)
+// positions after end shift by insert->size - (end - begin)
+void dl_splice(struct draw_list *list, uint32_t begin, uint32_t end, const struct draw_list *insert);
+// makes dst a copy of src, keeping dst's storage
+void dl_copy(struct draw_list *dst, const struct draw_list *src);
+// hashes the recorded content, returns false if it is identical to what was recorded before the reset
+bool dl_finish(struct draw_list *list);
+// iterate: uint32_t it = 0; struct dl_cmd cmd; while (dl_next(list, &it, &cmd)) { ... }
+bool dl_next(const struct draw_list *list, uint32_t *it, struct dl_cmd *cmd);
+
+#endif
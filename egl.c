@@ -1,24 +1,123 @@
+#include "draw_list.h"
+#include "glyph.h"
+#include "frame_stats.h"
+#include "helper/util.h"
+
 EGLDisplay egl_display_var = EGL_NO_DISPLAY;   // Represents the EGL display connection
 EGLContext egl_context = EGL_NO_CONTEXT;       // Represents the EGL rendering context
 EGLSurface egl_surface = EGL_NO_SURFACE;       // Represents the EGL window surface
 EGLConfig egl_config;                          // Holds the EGL frame buffer configuration
 struct wl_egl_window *egl_window = NULL;       // Represents the Wayland EGL window
-GLuint shader_program = 0;                     // OpenGL shader program identifier
-GLuint vbo = 0;                                // Vertex Buffer Object identifier
+GLuint vbo = 0;                                // Vertex Buffer Object identifier, used as a ring (vertex stream)
+GLsizeiptr vbo_size = 4 << 20;                 // bytes, grows if a single frame does not fit
+GLsizeiptr vbo_head = 0;                       // next free byte in the ring
+GLintptr egl_vertex_offset = 0;                // where the vertices of the current list start in the ring
+GLuint atlas_texture = 0;                      // glyph atlas, GL_ALPHA coverage
+uint32_t atlas_texture_generation = 0;         // glyph_atlas.generation that was last uploaded
+
+// shader variants, all generated from the one source below by prepending defines
+// a variant is compiled the first time a batch needs it and cached by its key from then on
+// glyph.c only makes A8 coverage, subpixel or distance field variants need an atlas that holds those first
+enum egl_shader_variant {
+    SHADER_SOLID,        // flat color, no texture fetch (rects)
+    SHADER_GRAYSCALE_AA, // atlas holds coverage
+    SHADER_VARIANT_COUNT
+};
+static const char *const shader_variant_defines[SHADER_VARIANT_COUNT] = {
+    "#define SOLID\n",
+    "#define GRAYSCALE_AA\n",
+};
+struct egl_shader {
+    GLuint program;                   // 0 until first use
+    bool failed;                      // do not retry a variant that did not compile
+    GLint position, texcoord, color;  // attribute locations, -1 if the variant does not use it
+    GLint viewport, atlas;            // uniform locations, resolved once after linking
+};
+struct egl_shader egl_shaders[SHADER_VARIANT_COUNT];
+enum egl_shader_variant egl_text_variant = SHADER_GRAYSCALE_AA; // how glyph runs are drawn
+
+// positions come in pixels with a top-left origin
+static const char *const vertex_shader_source =
+    "attribute vec2 position;\n"
+    "attribute vec4 color;\n"
+    "uniform vec2 viewport;\n"
+    "varying vec4 v_color;\n"
+    "#ifndef SOLID\n"
+    "attribute vec2 texcoord;\n"
+    "varying vec2 v_texcoord;\n"
+    "#endif\n"
+    "void main() {\n"
+    "#ifndef SOLID\n"
+    "    v_texcoord = texcoord;\n"
+    "#endif\n"
+    "    v_color = color;\n"
+    "    gl_Position = vec4(position.x / viewport.x * 2.0 - 1.0, 1.0 - position.y / viewport.y * 2.0, 0.0, 1.0);\n"
+    "}\n";
+static const char *const fragment_shader_source =
+    "precision mediump float;\n"
+    "varying vec4 v_color;\n"
+    "#ifndef SOLID\n"
+    "uniform sampler2D atlas;\n"
+    "varying vec2 v_texcoord;\n"
+    "#endif\n"
+    "void main() {\n"
+    "#if defined(SOLID)\n"
+    "    gl_FragColor = v_color;\n"
+    "#elif defined(GRAYSCALE_AA)\n"
+    "    gl_FragColor = vec4(v_color.rgb, v_color.a * texture2D(atlas, v_texcoord).a);\n"
+    "#endif\n"
+    "}\n";
+
+// vertices of the replayed draw list, rebuilt only when the list changes
+struct egl_vertex {
+    GLfloat x, y; // pixels, top-left origin
+    GLfloat u, v; // atlas texture coordinates
+    GLubyte r, g, b, a;
+};
+struct egl_vertex *egl_vertices = NULL;
+GLsizei egl_vertex_count = 0, egl_vertex_capacity = 0;
+// clip commands split the vertices into batches, each drawn with its own scissor
+// a new batch also starts whenever the shader variant changes
+struct egl_batch {
+    GLint first;
+    GLsizei count;
+    int x, y, w, h; // clip, w == 0 means none
+    enum egl_shader_variant variant;
+};
+struct egl_batch *egl_batches = NULL;
+int egl_batch_count = 0, egl_batch_capacity = 0;
+const struct draw_list *egl_list = NULL;       // list (and generation) the vertex buffer holds
+uint32_t egl_list_generation = 0;
+enum egl_shader_variant egl_list_variant;      // egl_text_variant the vertices were built for
+GLuint headless_fbo = 0, headless_color = 0;   // offscreen target of the headless backend
+
+// damage tracking for partial swaps, rects are in surface coordinates with a top-left origin
+#define EGL_MAX_DAMAGE_RECTS 16
+#define EGL_DAMAGE_HISTORY 4                   // how many past frames we remember, limits the usable buffer age
+struct egl_rect { int x, y, w, h; };
+struct egl_rect egl_damage[EGL_MAX_DAMAGE_RECTS]; // what changed since the last swap
+int egl_damage_count = 0;
+bool egl_damage_full = true;                   // first frame (and overflow) repaints everything
+struct egl_rect egl_damage_history[EGL_DAMAGE_HISTORY]; // bounding box of the damage of previous frames, [0] = last
+int egl_damage_history_count = 0;
+PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC egl_swap_with_damage = NULL; // NULL if neither KHR nor EXT variant is available
+PFNEGLSETDAMAGEREGIONKHRPROC egl_set_damage_region = NULL;      // NULL without EGL_KHR_partial_update
+bool egl_has_buffer_age = false;               // EGL_EXT_buffer_age or EGL_KHR_partial_update
 
 void print_egl_error(const char *msg) {
     EGLint error = eglGetError();
     fprintf(stderr, "%s: EGL error 0x%X\n", msg, error);
 }
 
-GLuint compile_shader(const char *source, GLenum type) {
+GLuint compile_shader(const char *defines, const char *source, GLenum type) {
     GLuint shader = glCreateShader(type);
     if (!shader) {
         fprintf(stderr, "Failed to create shader of type %d\n", type);
         return 0;
     }
 
-    glShaderSource(shader, 1, &source, NULL);
+    const char *sources[] = {defines, source};
+    glShaderSource(shader, 2, sources, NULL);
     glCompileShader(shader);
 
     // Check for compilation errors
@@ -65,6 +164,54 @@ GLuint link_program(GLuint vertex_shader, GLuint fragment_shader) {
 
     return program;
 }
+// mark a region of the surface as changed, e.g. the lines touched by a text edit
+void egl_add_damage(int x, int y, int w, int h) {
+    if (w <= 0 || h <= 0) return;
+    if (egl_damage_count == EGL_MAX_DAMAGE_RECTS) {
+        egl_damage_full = true; // too fragmented to be worth tracking
+        return;
+    }
+    egl_damage[egl_damage_count++] = (struct egl_rect){x, y, w, h};
+}
+
+// EGL wants rects as x, y, w, h with a bottom-left origin
+static void egl_rect_to_egl(struct egl_rect r, EGLint *out) {
+    out[0] = r.x;
+    out[1] = height - r.y - r.h;
+    out[2] = r.w;
+    out[3] = r.h;
+}
+
+void init_gl_resources();
+
+#ifndef EGL_HEADLESS
+static struct egl_rect egl_rect_union(struct egl_rect a, struct egl_rect b) {
+    if (a.w <= 0 || a.h <= 0) return b;
+    if (b.w <= 0 || b.h <= 0) return a;
+    int x0 = a.x < b.x ? a.x : b.x;
+    int y0 = a.y < b.y ? a.y : b.y;
+    int x1 = a.x + a.w > b.x + b.w ? a.x + a.w : b.x + b.w;
+    int y1 = a.y + a.h > b.y + b.h ? a.y + a.h : b.y + b.h;
+    return (struct egl_rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+// look up the optional swap extensions, all of them can be missing
+static void init_egl_damage_extensions(const char *extensions) {
+    if (!extensions) return;
+    if (strstr(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+        egl_swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC) eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    } else if (strstr(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+        // same signature as the KHR variant
+        egl_swap_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC) eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    }
+    if (strstr(extensions, "EGL_KHR_partial_update")) {
+        egl_set_damage_region = (PFNEGLSETDAMAGEREGIONKHRPROC) eglGetProcAddress("eglSetDamageRegionKHR");
+    }
+    egl_has_buffer_age = egl_set_damage_region || strstr(extensions, "EGL_EXT_buffer_age");
+    printf("EGL damage: swap_with_damage=%d partial_update=%d buffer_age=%d\n",
+           egl_swap_with_damage != NULL, egl_set_damage_region != NULL, egl_has_buffer_age);
+}
+
 // initialize EGL, compile shaders, set up OpenGL ES resources
 void init_egl() {
     // Get the EGL display connection
@@ -141,127 +288,472 @@ void init_egl() {
         exit(1);
     }
     printf("EGL initialized successfully with wl_egl_window.\n");
-    // Define shader source code
-    const char *vertex_shader_source =
-        "attribute vec2 position;\n"
-        "attribute vec3 color;\n"
-        "varying vec3 v_color;\n"
-        "void main() {\n"
-        "    v_color = color;\n"
-        "    gl_Position = vec4(position, 0.0, 1.0);\n"
-        "}\n";
-    const char *fragment_shader_source =
-        "precision mediump float;\n"
-        "varying vec3 v_color;\n"
-        "void main() {\n"
-        "    gl_FragColor = vec4(v_color, 1.0);\n"
-        "}\n";
-    // Compile shaders
-    GLuint vertex_shader = compile_shader(vertex_shader_source, GL_VERTEX_SHADER);
-    if (!vertex_shader) {
-        fprintf(stderr, "Vertex shader compilation failed\n");
-        exit(1);
+    init_egl_damage_extensions(extensions);
+    init_gl_resources();
+}
+#endif
+
+// set up the buffers and textures the renderer needs, needs a current context
+// shader variants are compiled later, when a frame first uses them
+void init_gl_resources() {
+    // the vertex buffer is a ring that draw_egl streams the draw list into
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, vbo_size, NULL, GL_STREAM_DRAW);
+    // glyph atlas texture, contents are uploaded lazily as glyphs get rasterized
+    glGenTextures(1, &atlas_texture);
+    glBindTexture(GL_TEXTURE_2D, atlas_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, GLYPH_ATLAS_SIZE, GLYPH_ATLAS_SIZE, 0, GL_ALPHA, GL_UNSIGNED_BYTE, NULL);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+}
+
+// returns the program for a variant, compiling and linking it on first use, 0 if it failed to build
+static const struct egl_shader *egl_get_shader(enum egl_shader_variant variant) {
+    struct egl_shader *shader = &egl_shaders[variant];
+    if (shader->program || shader->failed) return shader->program ? shader : NULL;
+    const char *defines = shader_variant_defines[variant];
+    GLuint vertex_shader = compile_shader(defines, vertex_shader_source, GL_VERTEX_SHADER);
+    GLuint fragment_shader = compile_shader(defines, fragment_shader_source, GL_FRAGMENT_SHADER);
+    if (vertex_shader && fragment_shader) {
+        shader->program = link_program(vertex_shader, fragment_shader);
     }
-    GLuint fragment_shader = compile_shader(fragment_shader_source, GL_FRAGMENT_SHADER);
-    if (!fragment_shader) {
-        fprintf(stderr, "Fragment shader compilation failed\n");
-        glDeleteShader(vertex_shader);
-        exit(1);
+    // Shaders are linked into the program; they can be deleted now
+    if (vertex_shader) glDeleteShader(vertex_shader);
+    if (fragment_shader) glDeleteShader(fragment_shader);
+    if (!shader->program) {
+        fprintf(stderr, "Shader variant %s failed to build\n", defines);
+        shader->failed = true;
+        return NULL;
     }
-    // Link shaders into a program
-    shader_program = link_program(vertex_shader, fragment_shader);
-    if (!shader_program) {
-        fprintf(stderr, "Shader program linking failed\n");
-        glDeleteShader(vertex_shader);
-        glDeleteShader(fragment_shader);
-        exit(1);
+    // find attributes and uniforms once, they do not change after linking
+    shader->position = glGetAttribLocation(shader->program, "position");
+    shader->texcoord = glGetAttribLocation(shader->program, "texcoord");
+    shader->color = glGetAttribLocation(shader->program, "color");
+    shader->viewport = glGetUniformLocation(shader->program, "viewport");
+    shader->atlas = glGetUniformLocation(shader->program, "atlas");
+    // uniforms that never change are set right away
+    glUseProgram(shader->program);
+    if (shader->atlas >= 0) glUniform1i(shader->atlas, 0);
+    return shader;
+}
+
+// uploads the rows of the glyph atlas that changed since the last upload
+static void egl_upload_atlas(void) {
+    if (atlas_texture_generation == glyph_atlas.generation) return;
+    const int y0 = glyph_atlas.dirty_y0, y1 = glyph_atlas.dirty_y1;
+    if (y1 > y0) {
+        glBindTexture(GL_TEXTURE_2D, atlas_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y0, GLYPH_ATLAS_SIZE, y1 - y0, GL_ALPHA, GL_UNSIGNED_BYTE,
+                        &glyph_atlas.pixels[y0 * GLYPH_ATLAS_SIZE]);
     }
-    // Shaders are linked into the program; they can be deleted now
-    glDeleteShader(vertex_shader);
-    glDeleteShader(fragment_shader);
-    // Define vertex data for a colored triangle
-    GLfloat vertices[] = {
-        // Positions    // Colors
-         0.0f,  0.5f,    1.0f, 0.0f, 0.0f, // Top vertex (Red)
-        -0.5f, -0.5f,    0.0f, 1.0f, 0.0f, // Bottom left vertex (Green)
-         0.5f, -0.5f,    0.0f, 0.0f, 1.0f  // Bottom right vertex (Blue)
-    };
-    // Generate and bind a vertex buffer ('vertex buffer object')
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo); // becomes the currently bound buffer
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-    // Use the shader program
-    glUseProgram(shader_program);
-    // find attributes in the shader program (need to use program first)
-    GLint pos_attrib = glGetAttribLocation(shader_program, "position");
-    GLint col_attrib = glGetAttribLocation(shader_program, "color");
-    // set these attributes as being found in an array
-    glEnableVertexAttribArray(pos_attrib);
-    glEnableVertexAttribArray(col_attrib);
-    // specify that the data for the attributes can be found in certain offsets and size in the array
-    // gl knows that this concerns the vertex buffer, because it is the currently bound buffer
-    glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)0);
-    glVertexAttribPointer(col_attrib, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
+    glyph_atlas.dirty_y0 = glyph_atlas.dirty_y1 = 0;
+    atlas_texture_generation = glyph_atlas.generation;
+}
+
+static struct egl_vertex *egl_reserve_vertices(GLsizei count) {
+    if (egl_vertex_count + count > egl_vertex_capacity) {
+        egl_vertex_capacity = egl_vertex_capacity ? egl_vertex_capacity * 2 : 4096;
+        while (egl_vertex_capacity < egl_vertex_count + count) egl_vertex_capacity *= 2;
+        egl_vertices = realloc(egl_vertices, egl_vertex_capacity * sizeof(struct egl_vertex));
+        if (!egl_vertices) {
+            fprintf(stderr, "Failed to allocate %d vertices\n", egl_vertex_capacity);
+            exit(1);
+        }
+    }
+    struct egl_vertex *v = &egl_vertices[egl_vertex_count];
+    egl_vertex_count += count;
+    return v;
+}
+
+// two triangles covering x0,y0 - x1,y1 with atlas rect u0,v0 - u1,v1
+static void egl_push_quad(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1, uint32_t color) {
+    const GLubyte r = color >> 16, g = color >> 8, b = color, a = color >> 24;
+    struct egl_vertex *v = egl_reserve_vertices(6);
+    v[0] = (struct egl_vertex){x0, y0, u0, v0, r, g, b, a};
+    v[1] = (struct egl_vertex){x1, y0, u1, v0, r, g, b, a};
+    v[2] = (struct egl_vertex){x0, y1, u0, v1, r, g, b, a};
+    v[3] = v[2];
+    v[4] = v[1];
+    v[5] = (struct egl_vertex){x1, y1, u1, v1, r, g, b, a};
+}
+
+// closes the current batch and starts the next one at the current vertex
+static void egl_begin_batch(struct egl_batch next) {
+    if (egl_batch_count > 0) {
+        struct egl_batch *last = &egl_batches[egl_batch_count - 1];
+        last->count = egl_vertex_count - last->first;
+        if (last->count == 0) egl_batch_count--; // nothing drawn with that state
+    }
+    if (egl_batch_count == egl_batch_capacity) {
+        egl_batch_capacity = egl_batch_capacity ? egl_batch_capacity * 2 : 64;
+        egl_batches = realloc(egl_batches, egl_batch_capacity * sizeof(struct egl_batch));
+        if (!egl_batches) {
+            fprintf(stderr, "Failed to allocate %d batches\n", egl_batch_capacity);
+            exit(1);
+        }
+    }
+    next.first = egl_vertex_count;
+    next.count = 0;
+    egl_batches[egl_batch_count++] = next;
+}
+
+static void egl_use_variant(enum egl_shader_variant variant) {
+    const struct egl_batch *current = &egl_batches[egl_batch_count - 1];
+    if (current->variant == variant) return;
+    struct egl_batch next = *current;
+    next.variant = variant;
+    egl_begin_batch(next);
+}
+
+// writes the vertices into the next free segment of the ring
+// segments behind the head may still be read by frames in flight, so they are never overwritten in place:
+// when the ring is full the buffer is orphaned (glBufferData with NULL) and the driver hands out fresh storage
+static void egl_stream_vertices(void) {
+    const uint64_t start = get_time_ns();
+    const GLsizeiptr bytes = egl_vertex_count * sizeof(struct egl_vertex);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    if (vbo_head + bytes > vbo_size) {
+        while (bytes > vbo_size) vbo_size *= 2;
+        glBufferData(GL_ARRAY_BUFFER, vbo_size, NULL, GL_STREAM_DRAW);
+        vbo_head = 0;
+        frame_stats.stream_wraps++;
+    }
+    glBufferSubData(GL_ARRAY_BUFFER, vbo_head, bytes, egl_vertices);
+    egl_vertex_offset = vbo_head;
+    vbo_head += bytes;
+    frame_stats.upload_bytes += bytes;
+    frame_stats.upload_ns += get_time_ns() - start;
+}
+
+// turns the draw list into vertices and uploads them
+static void egl_build_vertices(const struct draw_list *list) {
+    const float texel = 1.0f / GLYPH_ATLAS_SIZE;
+    const struct glyph *solid = &glyphs[GLYPH_SOLID];
+    // sample the middle of the solid block so filtering never reaches its edges
+    const float su = (solid->atlas_x + solid->w * 0.5f) * texel, sv = (solid->atlas_y + solid->h * 0.5f) * texel;
+    egl_vertex_count = 0;
+    egl_batch_count = 0;
+    egl_begin_batch((struct egl_batch){.variant = SHADER_SOLID});
+    uint32_t it = 0;
+    struct dl_cmd cmd;
+    while (dl_next(list, &it, &cmd)) {
+        switch (cmd.op) {
+        case DL_RECT: {
+            const struct dl_rect *r = &cmd.rect;
+            egl_use_variant(SHADER_SOLID);
+            egl_push_quad(r->x, r->y, r->x + r->w, r->y + r->h, su, sv, su, sv, r->color);
+            break;
+        }
+        case DL_GLYPHS:
+            egl_use_variant(egl_text_variant);
+            for (int i = 0; i < cmd.glyphs.count; i++) {
+                const struct glyph *glyph = &glyphs[cmd.glyphs.glyphs[i].id];
+                const float x = cmd.glyphs.x + cmd.glyphs.glyphs[i].x, y = cmd.glyphs.y;
+                egl_push_quad(x, y, x + glyph->w, y + glyph->h,
+                              glyph->atlas_x * texel, glyph->atlas_y * texel,
+                              (glyph->atlas_x + glyph->w) * texel, (glyph->atlas_y + glyph->h) * texel, cmd.glyphs.color);
+            }
+            break;
+        case DL_CLIP: {
+            struct egl_batch next = egl_batches[egl_batch_count - 1];
+            next.x = cmd.rect.x;
+            next.y = cmd.rect.y;
+            next.w = cmd.rect.w;
+            next.h = cmd.rect.h;
+            egl_begin_batch(next);
+            break;
+        }
+        }
+    }
+    egl_begin_batch((struct egl_batch){0}); // closes the last batch
+    egl_batch_count--;
+    egl_stream_vertices();
+    egl_list = list;
+    egl_list_generation = list->generation;
+    egl_list_variant = egl_text_variant;
 }
 
-void draw_egl() {
-    // Clear the color buffer NEEDED EVERY FRAME?
-    glClearColor(0.2f, 0.3f, 0.3f, 1.0f); // Dark teal background
-    glClear(GL_COLOR_BUFFER_BIT);
+// points the attributes of a variant at the current vertex segment
+static void egl_bind_attributes(const struct egl_shader *shader, bool enable) {
+    const GLint attributes[] = {shader->position, shader->texcoord, shader->color};
+    const GLint sizes[] = {2, 2, 4};
+    const GLenum types[] = {GL_FLOAT, GL_FLOAT, GL_UNSIGNED_BYTE};
+    const size_t offsets[] = {offsetof(struct egl_vertex, x), offsetof(struct egl_vertex, u), offsetof(struct egl_vertex, r)};
+    for (int i = 0; i < 3; i++) {
+        if (attributes[i] < 0) continue;
+        if (!enable) {
+            glDisableVertexAttribArray(attributes[i]);
+            continue;
+        }
+        glEnableVertexAttribArray(attributes[i]);
+        glVertexAttribPointer(attributes[i], sizes[i], types[i], types[i] == GL_UNSIGNED_BYTE, sizeof(struct egl_vertex),
+                              (void*)(egl_vertex_offset + offsets[i]));
+    }
+}
 
-    // THIS PART IS NOT NEEDED EVERY FRAME, CAN AVOID IF NO CHANGES BETWEEN FRAMES
+// replays the vertices of the draw list, every batch scissored to its clip intersected with the repaint region
+static void egl_replay(struct egl_rect repaint) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, atlas_texture);
     glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glUseProgram(shader_program);
-    GLint pos_attrib = glGetAttribLocation(shader_program, "position");
-    GLint col_attrib = glGetAttribLocation(shader_program, "color");
-    glEnableVertexAttribArray(pos_attrib);
-    glEnableVertexAttribArray(col_attrib);
-    glVertexAttribPointer(pos_attrib, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)0);
-    glVertexAttribPointer(col_attrib, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(GLfloat), (void*)(2 * sizeof(GLfloat)));
-    // END PART THAT CAN BE AVOIDED EACH FRAME
-
-    // Draw the triangle
-    glDrawArrays(GL_TRIANGLES, 0, 3);
-
-    // ALSO NOT NEEDED EVERY FRAME IF NOTHING CHANGES
-    glDisableVertexAttribArray(pos_attrib);
-    glDisableVertexAttribArray(col_attrib);
-    // END PART
+    glEnable(GL_SCISSOR_TEST);
+    const struct egl_shader *bound = NULL;
+    for (int i = 0; i < egl_batch_count; i++) {
+        const struct egl_batch *batch = &egl_batches[i];
+        struct egl_rect clip = repaint;
+        if (batch->w > 0) {
+            // intersect the clip command with the repaint region
+            const int x0 = batch->x > clip.x ? batch->x : clip.x;
+            const int y0 = batch->y > clip.y ? batch->y : clip.y;
+            const int x1 = batch->x + batch->w < clip.x + clip.w ? batch->x + batch->w : clip.x + clip.w;
+            const int y1 = batch->y + batch->h < clip.y + clip.h ? batch->y + batch->h : clip.y + clip.h;
+            if (x1 <= x0 || y1 <= y0) continue;
+            clip = (struct egl_rect){x0, y0, x1 - x0, y1 - y0};
+        }
+        const struct egl_shader *shader = egl_get_shader(batch->variant);
+        if (!shader) continue;
+        if (shader != bound) {
+            if (bound) egl_bind_attributes(bound, false);
+            glUseProgram(shader->program);
+            glUniform2f(shader->viewport, width, height);
+            egl_bind_attributes(shader, true);
+            bound = shader;
+        }
+        EGLint rect[4];
+        egl_rect_to_egl(clip, rect);
+        glScissor(rect[0], rect[1], rect[2], rect[3]);
+        glDrawArrays(GL_TRIANGLES, batch->first, batch->count);
+    }
+    if (bound) egl_bind_attributes(bound, false);
+    glDisable(GL_SCISSOR_TEST);
+}
+
+#ifndef EGL_HEADLESS
+void draw_egl(const struct draw_list *list) {
+    const struct egl_rect full = {0, 0, width, height};
+    // what changed this frame, this is what the compositor needs to know about
+    struct egl_rect damage = {0};
+    for (int i = 0; i < egl_damage_count; i++) damage = egl_rect_union(damage, egl_damage[i]);
+    if (egl_damage_full) damage = full;
+
+    // what we have to repaint: this frame's damage plus everything the back buffer missed since it was last shown
+    // an age of 0 means the contents are undefined and everything has to be redrawn
+    struct egl_rect repaint = full;
+    EGLint age = 0;
+    if (egl_has_buffer_age) {
+        eglQuerySurface(egl_display_var, egl_surface, EGL_BUFFER_AGE_KHR, &age);
+    }
+    if (age > 0 && age - 1 <= egl_damage_history_count) {
+        repaint = damage;
+        for (int i = 0; i < age - 1; i++) repaint = egl_rect_union(repaint, egl_damage_history[i]);
+    }
+    if (egl_set_damage_region) {
+        EGLint rect[4];
+        egl_rect_to_egl(repaint, rect);
+        egl_set_damage_region(egl_display_var, egl_surface, rect, 1);
+    }
+    // pixels outside the scissor keep the contents of the reused buffer
+    if (repaint.w > 0 && repaint.h > 0) {
+        egl_upload_atlas();
+        if (list != egl_list || list->generation != egl_list_generation || egl_list_variant != egl_text_variant) {
+            egl_build_vertices(list);
+        }
+        egl_replay(repaint);
+    }
 
     // Swap the front and back buffers to display the rendered image
-    if (!eglSwapBuffers(egl_display_var, egl_surface)) {
+    // with damage the compositor only has to recomposite the rects that changed
+    EGLBoolean swapped;
+    if (egl_swap_with_damage && !egl_damage_full) {
+        // no rects would mean the whole surface, a frame where nothing changed posts one empty rect instead
+        EGLint rects[EGL_MAX_DAMAGE_RECTS * 4] = {0};
+        for (int i = 0; i < egl_damage_count; i++) egl_rect_to_egl(egl_damage[i], &rects[i * 4]);
+        swapped = egl_swap_with_damage(egl_display_var, egl_surface, rects, egl_damage_count ? egl_damage_count : 1);
+    } else {
+        swapped = eglSwapBuffers(egl_display_var, egl_surface);
+    }
+    if (!swapped) {
         print_egl_error("Failed to swap buffers");
     }
 
+    // remember this frame's damage for buffers that come back with an age > 1
+    memmove(&egl_damage_history[1], &egl_damage_history[0], (EGL_DAMAGE_HISTORY - 1) * sizeof(struct egl_rect));
+    egl_damage_history[0] = damage;
+    if (egl_damage_history_count < EGL_DAMAGE_HISTORY) egl_damage_history_count++;
+    egl_damage_count = 0;
+    egl_damage_full = false;
+
     // -IMPORTANT FUNCTION: render loop is created here
     // TODO: subsurface gets updated here with this callback
     // callback that hands over control for when next frame is drawn, and then the other callback is called
-    struct wl_callback *callback = wl_surface_frame(first_surface);
+    struct wl_callback *callback = PROTOCOL_REQUEST(wl_surface_frame(first_surface));
     wl_callback_add_listener(callback, &frame_listener, NULL);
 
     // Commit the surface to display the frame
-    wl_surface_commit(first_surface);
+    // the attach, damage and commit eglSwapBuffers sends itself are not counted
+    PROTOCOL_REQUEST(wl_surface_commit(first_surface));
 }
+#endif
 
 void cleanup_egl() {
     if (egl_display_var != EGL_NO_DISPLAY) {
         eglMakeCurrent(egl_display_var, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
         if (egl_context != EGL_NO_CONTEXT) {
-            glDeleteProgram(shader_program); // Delete shader program
+            for (int i = 0; i < SHADER_VARIANT_COUNT; i++) {
+                if (egl_shaders[i].program) glDeleteProgram(egl_shaders[i].program); // Delete shader programs
+            }
+            memset(egl_shaders, 0, sizeof(egl_shaders));
             glDeleteBuffers(1, &vbo);        // Delete VBO
+            glDeleteTextures(1, &atlas_texture);
+            glDeleteFramebuffers(1, &headless_fbo);
+            glDeleteRenderbuffers(1, &headless_color);
+            free(egl_vertices);
+            egl_vertices = NULL;
+            free(egl_batches);
+            egl_batches = NULL;
             eglDestroyContext(egl_display_var, egl_context);
         }
         if (egl_surface != EGL_NO_SURFACE) {
             eglDestroySurface(egl_display_var, egl_surface);
         }
+#ifndef EGL_HEADLESS
         if (egl_window) {
             wl_egl_window_destroy(egl_window);
         }
+#endif
         eglTerminate(egl_display_var);
         egl_display_var = EGL_NO_DISPLAY;
     }
 }
 
+// headless backend: no compositor, render into an FBO and read the pixels back
+// tries EGL_MESA_platform_surfaceless first, then the default display with a 1x1 pbuffer to make the context current
+// with LIBGL_ALWAYS_SOFTWARE=1 Mesa uses llvmpipe, so this also runs on machines without a GPU
+bool init_egl_headless(int w, int h) {
+    bool surfaceless = false;
+    const char *client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (client_extensions && strstr(client_extensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (get_platform_display) {
+            egl_display_var = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            surfaceless = egl_display_var != EGL_NO_DISPLAY;
+        }
+    }
+    if (!surfaceless) {
+        egl_display_var = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (egl_display_var == EGL_NO_DISPLAY || !eglInitialize(egl_display_var, NULL, NULL)) {
+        print_egl_error("Failed to initialize headless EGL");
+        egl_display_var = EGL_NO_DISPLAY;
+        return false;
+    }
+    // without EGL_KHR_surfaceless_context a context can only be made current with a surface
+    const char *extensions = eglQueryString(egl_display_var, EGL_EXTENSIONS);
+    const bool use_pbuffer = !extensions || !strstr(extensions, "EGL_KHR_surfaceless_context");
+    const EGLint config_attribs[] = {
+        EGL_SURFACE_TYPE, use_pbuffer ? EGL_PBUFFER_BIT : 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_RED_SIZE,     8,
+        EGL_GREEN_SIZE,   8,
+        EGL_BLUE_SIZE,    8,
+        EGL_ALPHA_SIZE,   8,
+        EGL_NONE
+    };
+    EGLint num_configs;
+    if (!eglChooseConfig(egl_display_var, config_attribs, &egl_config, 1, &num_configs) || num_configs == 0) {
+        print_egl_error("Failed to choose headless EGL config");
+        cleanup_egl();
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+    egl_context = eglCreateContext(egl_display_var, egl_config, EGL_NO_CONTEXT, context_attribs);
+    if (egl_context == EGL_NO_CONTEXT) {
+        print_egl_error("Failed to create headless EGL context");
+        cleanup_egl();
+        return false;
+    }
+    if (use_pbuffer) {
+        const EGLint pbuffer_attribs[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        egl_surface = eglCreatePbufferSurface(egl_display_var, egl_config, pbuffer_attribs);
+        if (egl_surface == EGL_NO_SURFACE) {
+            print_egl_error("Failed to create pbuffer");
+            cleanup_egl();
+            return false;
+        }
+    }
+    if (!eglMakeCurrent(egl_display_var, egl_surface, egl_surface, egl_context)) {
+        print_egl_error("Failed to make headless EGL context current");
+        cleanup_egl();
+        return false;
+    }
+    // the frame itself lives in an FBO of the requested size, independent of the (tiny or missing) surface
+    const char *gl_extensions = (const char *) glGetString(GL_EXTENSIONS);
+    const bool rgba8 = gl_extensions && strstr(gl_extensions, "GL_OES_rgb8_rgba8");
+    glGenRenderbuffers(1, &headless_color);
+    glBindRenderbuffer(GL_RENDERBUFFER, headless_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, rgba8 ? GL_RGBA8_OES : GL_RGBA4, w, h);
+    glGenFramebuffers(1, &headless_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headless_color);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Headless framebuffer is incomplete\n");
+        cleanup_egl();
+        return false;
+    }
+    width = w;
+    height = h;
+    glViewport(0, 0, w, h);
+    printf("EGL initialized headless (%s) on %s\n", use_pbuffer ? "pbuffer" : "surfaceless", glGetString(GL_RENDERER));
+    init_gl_resources();
+    return true;
+}
+
+// replays the list into the headless FBO, only x0..x1, y0..y1 since nothing is swapped and the rest stays
+void draw_egl_headless_region(const struct draw_list *list, int x0, int y0, int x1, int y1) {
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    egl_upload_atlas();
+    if (list != egl_list || list->generation != egl_list_generation || egl_list_variant != egl_text_variant) {
+        egl_build_vertices(list);
+    }
+    egl_replay((struct egl_rect){x0, y0, x1 - x0, y1 - y0});
+}
+
+void draw_egl_headless(const struct draw_list *list) {
+    draw_egl_headless_region(list, 0, 0, width, height);
+}
+
+// reads the frame back as ARGB8888, top row first like the shm buffers, so it compares directly with cpu_draw.c
+void egl_read_frame(uint32_t *pixels) {
+    glBindFramebuffer(GL_FRAMEBUFFER, headless_fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    // GL rows are bottom up and the bytes are R, G, B, A
+    for (int y = 0; y < height / 2; y++) {
+        uint32_t *top = pixels + (size_t) y * width, *bottom = pixels + (size_t) (height - 1 - y) * width;
+        for (int x = 0; x < width; x++) {
+            const uint32_t t = top[x];
+            top[x] = bottom[x];
+            bottom[x] = t;
+        }
+    }
+    for (size_t i = 0; i < (size_t) width * height; i++) {
+        const uint32_t p = pixels[i];
+        pixels[i] = (p & 0xFF00FF00) | ((p & 0xFF) << 16) | ((p >> 16) & 0xFF);
+    }
+}
+
+#ifndef EGL_HEADLESS
 void cleanup_wl_xdg(void)
 {
     if (window) {
@@ -286,3 +778,4 @@ void cleanup_wl_xdg(void)
         wl_display_disconnect(display);
     }
 }
+#endif
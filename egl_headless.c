@@ -0,0 +1,187 @@
+// renders a document with the GL backend without a compositor, compares it against the CPU backend and times it
+// LIBGL_ALWAYS_SOFTWARE=1 ./egl_headless example_text.txt [frames] [out.ppm]
+// TEXT_REPLAY=input.trace [TEXT_REPLAY_SPEED=1] also replays an input trace recorded by main2 and reports its latency
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+
+#include "helper/util.h"
+#include "layout.h"
+#include "cpu_draw.h"
+#include "input_trace.h"
+
+#define AXIS_VERTICAL 0 // WL_POINTER_AXIS_VERTICAL_SCROLL, this runs without wayland
+#define KEY_BACKSPACE_SYM 0xff08 // XKB_KEY_BackSpace, and without xkbcommon
+#define CURSOR_LINE 3 // where replayed keys type, like in alloc_check.c
+
+#define EGL_HEADLESS
+int width = 800;
+int height = 600;
+#include "egl.c"
+
+static void write_ppm(const char *path, const uint32_t *pixels, int w, int h) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", w, h);
+    for (int i = 0; i < w * h; i++) {
+        const uint8_t rgb[3] = {pixels[i] >> 16, pixels[i] >> 8, pixels[i]};
+        fwrite(rgb, 3, 1, f);
+    }
+    fclose(f);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// types a key into line CURSOR_LINE the way alloc_check.c does, returns the byte the line changed at, SIZE_MAX if it did not
+// keys other than text and backspace are skipped, they only move the cursor in main2
+static size_t replay_key(struct document *document, const struct app_event *event, size_t *cursor_byte) {
+    if (event->a == KEY_BACKSPACE_SYM && *cursor_byte > 0) {
+        const char *s;
+        size_t length;
+        document_line(document, CURSOR_LINE, &s, &length);
+        const size_t previous = utf8_previous(s, *cursor_byte);
+        if (document_erase(document, CURSOR_LINE, previous, *cursor_byte - previous)) {
+            *cursor_byte = previous;
+            return previous;
+        }
+    } else if (event->a != KEY_BACKSPACE_SYM && event->b >= 0x20) {
+        char bytes[4];
+        const int n = utf8_encode(event->b, bytes);
+        const size_t byte = *cursor_byte;
+        if (document_insert(document, CURSOR_LINE, byte, bytes, n)) {
+            *cursor_byte += n;
+            return byte;
+        }
+    }
+    return SIZE_MAX;
+}
+
+// replays the trace at its original pace times speed (0 = as fast as possible), every event is rendered and finished
+// latency is from when the event was due (when it was picked up at speed 0) to when its frame was done
+// keys edit the document, a keystroke lays out and repaints only its line like main2 does
+static void replay(const char *path, double speed, struct document *document) {
+    struct input_trace trace;
+    if (!input_trace_load(&trace, path) || trace.count == 0) return;
+    uint64_t *latency = malloc(trace.count * sizeof(*latency));
+    struct layout layout = {0};
+    size_t first_line = 0, cursor_byte = 0;
+    int32_t remainder = 0;
+    uint32_t keys = 0;
+    const uint64_t start = get_time_ns();
+    for (uint32_t i = 0; i < trace.count; i++) {
+        const struct app_event *event = &trace.events[i];
+        const uint64_t due = start + (speed > 0 ? (uint64_t) (event->timestamp_ns / speed) : 0);
+        uint64_t now = get_time_ns();
+        if (due > now) {
+            const struct timespec wait = {(due - now) / 1000000000, (due - now) % 1000000000};
+            nanosleep(&wait, NULL);
+        }
+        const uint64_t picked_up = speed > 0 ? due : get_time_ns();
+        size_t edit_byte = SIZE_MAX;
+        if (event->type == APP_EVENT_POINTER_AXIS && event->a == AXIS_VERTICAL) {
+            first_line = layout_scroll(first_line, document->line_count, event->b, &remainder);
+        } else if (event->type == APP_EVENT_KEY) {
+            edit_byte = replay_key(document, event, &cursor_byte);
+            keys++;
+        }
+        const struct view view = {.first_line = first_line, .width = width, .height = height, .font_size = 16,
+                                  .background = 0xFF1E1E1E, .foreground = 0xFFD4D4D4,
+                                  .show_cursor = true, .cursor_line = CURSOR_LINE, .cursor_byte = cursor_byte};
+        if (edit_byte != SIZE_MAX && layout_update_line(&layout, document, &view, CURSOR_LINE, edit_byte)) {
+            draw_egl_headless_region(&layout.list, layout.damage_x0, layout.damage_y0, layout.damage_x1, layout.damage_y1);
+        } else {
+            layout_update(&layout, document, &view);
+            draw_egl_headless(&layout.list);
+        }
+        glFinish();
+        now = get_time_ns();
+        latency[i] = now > picked_up ? now - picked_up : 0;
+    }
+    const uint64_t total = get_time_ns() - start;
+    qsort(latency, trace.count, sizeof(*latency), compare_u64);
+    printf("replay: %u events (%u keys) in %lu ms (%.0f events/s), latency p50 %lu us p99 %lu us max %lu us\n",
+           trace.count, keys, (unsigned long) (total / 1000000), trace.count * 1e9 / total,
+           (unsigned long) (latency[trace.count / 2] / 1000), (unsigned long) (latency[(trace.count - 1) * 99 / 100] / 1000),
+           (unsigned long) (latency[trace.count - 1] / 1000));
+    free(latency);
+    layout_free(&layout);
+    input_trace_free(&trace);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "example_text.txt";
+    const int frames = argc > 2 ? atoi(argv[2]) : 100;
+    struct document document;
+    if (!document_load(&document, path)) return 1;
+    document_index_lines(&document, document.size);
+    if (!init_egl_headless(width, height)) return 1;
+
+    struct layout layout = {0};
+    const struct view view = {.width = width, .height = height, .font_size = 16,
+                              .background = 0xFF1E1E1E, .foreground = 0xFFD4D4D4};
+    layout_update(&layout, &document, &view);
+
+    // pixel test: the GL path has to match the CPU path, up to rounding in the blend
+    uint32_t *gl_pixels = malloc((size_t) width * height * 4);
+    uint32_t *cpu_pixels = malloc((size_t) width * height * 4);
+    draw_egl_headless(&layout.list);
+    egl_read_frame(gl_pixels);
+    const struct cpu_target target = {cpu_pixels, width, height, width};
+    cpu_draw_list(&layout.list, &target);
+    int mismatches = 0, max_diff = 0;
+    for (int i = 0; i < width * height; i++) {
+        int diff = 0;
+        for (int shift = 0; shift < 24; shift += 8) {
+            const int d = abs((int) ((gl_pixels[i] >> shift) & 0xFF) - (int) ((cpu_pixels[i] >> shift) & 0xFF));
+            if (d > diff) diff = d;
+        }
+        if (diff > 2) mismatches++;
+        if (diff > max_diff) max_diff = diff;
+    }
+    printf("pixel test: %d of %d pixels differ by more than 2 (max %d)\n", mismatches, width * height, max_diff);
+    if (argc > 3) write_ppm(argv[3], gl_pixels, width, height);
+
+    // timing: glFinish makes every frame pay for its rasterization, like a swap would
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < frames; i++) {
+        frame_stats_begin();
+        // a new generation forces the vertices to be rebuilt and streamed, like scrolling or typing would
+        layout.list.generation++;
+        draw_egl_headless(&layout.list);
+        glFinish();
+    }
+    frame_stats_print(stdout);
+    const uint64_t gl_ns = (get_time_ns() - start) / (frames ? frames : 1);
+    start = get_time_ns();
+    for (int i = 0; i < frames; i++) {
+        cpu_draw_list(&layout.list, &target);
+    }
+    const uint64_t cpu_ns = (get_time_ns() - start) / (frames ? frames : 1);
+    printf("frame %dx%d, %u glyphs: gl %lu us (with upload), cpu %lu us\n", width, height, layout.list.glyph_count,
+           gl_ns / 1000, cpu_ns / 1000);
+
+    const char *replay_path = getenv("TEXT_REPLAY");
+    if (replay_path) {
+        const char *speed = getenv("TEXT_REPLAY_SPEED");
+        replay(replay_path, speed ? atof(speed) : 1.0, &document);
+    }
+
+    free(gl_pixels);
+    free(cpu_pixels);
+    cleanup_egl();
+    return mismatches ? 2 : 0;
+}
@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "event_loop.h"
+
+bool event_loop_init(struct event_loop *loop) {
+    *loop = (struct event_loop){0};
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0) {
+        perror("epoll_create1");
+        return false;
+    }
+    return true;
+}
+
+void event_loop_destroy(struct event_loop *loop) {
+    if (loop->epoll_fd >= 0) close(loop->epoll_fd);
+    loop->count = 0;
+    loop->epoll_fd = -1;
+}
+
+bool event_loop_add(struct event_loop *loop, int fd, uint32_t events, event_loop_fn fn, void *arg) {
+    if (fd < 0 || loop->count == EVENT_LOOP_MAX_SOURCES) return false;
+    struct epoll_event event = {.events = events, .data.u32 = loop->count};
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        perror("epoll_ctl");
+        return false;
+    }
+    loop->sources[loop->count++] = (struct event_source){fd, fn, arg};
+    return true;
+}
+
+int event_loop_wait(struct event_loop *loop, int timeout_ms) {
+    struct epoll_event ready[EVENT_LOOP_MAX_SOURCES];
+    const int count = epoll_wait(loop->epoll_fd, ready, EVENT_LOOP_MAX_SOURCES, timeout_ms);
+    if (count <= 0) return 0; // timeout, or EINTR from a debugger
+    loop->wakeups++;
+    for (int i = 0; i < count; i++) {
+        const struct event_source *source = &loop->sources[ready[i].data.u32];
+        source->fn(source->arg, ready[i].events);
+    }
+    return count;
+}
+
+int event_loop_timer(void) {
+    return timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+void event_loop_timer_set(int fd, uint64_t delay_ns, uint64_t interval_ns) {
+    const struct itimerspec spec = {
+        .it_interval = {interval_ns / 1000000000, interval_ns % 1000000000},
+        .it_value = {delay_ns / 1000000000, delay_ns % 1000000000},
+    };
+    timerfd_settime(fd, 0, &spec, NULL);
+}
+
+uint64_t event_loop_timer_read(int fd) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    return expirations;
+}
@@ -0,0 +1,46 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// epoll over a handful of fds, the dispatch thread's only place to sleep
+// timers are timerfds and signals a signalfd, so a wakeup always says which source is ready
+// and the thread sleeps in epoll_wait until one is, with no timeout to poll on
+
+// runs when fd is ready, events are the epoll events it is ready for
+typedef void (*event_loop_fn)(void *arg, uint32_t events);
+
+#define EVENT_LOOP_MAX_SOURCES 8
+
+struct event_source {
+    int fd;
+    event_loop_fn fn;
+    void *arg;
+};
+
+struct event_loop {
+    int epoll_fd;
+    struct event_source sources[EVENT_LOOP_MAX_SOURCES];
+    int count;
+    uint64_t wakeups; // since startup, a loop that sleeps when idle keeps this low
+};
+
+bool event_loop_init(struct event_loop *loop);
+// closes the epoll fd, the fds added to it stay with whoever created them
+void event_loop_destroy(struct event_loop *loop);
+// level triggered: a callback that leaves work behind is called again on the next wakeup
+// so every callback should do a bounded amount and return
+bool event_loop_add(struct event_loop *loop, int fd, uint32_t events, event_loop_fn fn, void *arg);
+// sleeps until at least one source is ready (timeout_ms -1 waits forever), runs the ready callbacks once each
+// returns how many ran
+int event_loop_wait(struct event_loop *loop, int timeout_ms);
+
+// nonblocking CLOCK_MONOTONIC timerfd, -1 on failure
+int event_loop_timer(void);
+// first expiry after delay_ns, then every interval_ns (0 for once), a delay of 0 disarms
+void event_loop_timer_set(int fd, uint64_t delay_ns, uint64_t interval_ns);
+// expirations since the last read, 0 if the wakeup was stale
+uint64_t event_loop_timer_read(int fd);
+
+#endif
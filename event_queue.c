@@ -0,0 +1,155 @@
+#include <stdlib.h>
+
+#include "event_queue.h"
+
+void event_queue_init(struct event_queue *queue) {
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->sleeping, false);
+    atomic_init(&queue->notified, false);
+    queue->spill = NULL;
+    queue->spill_head = queue->spill_count = queue->spill_capacity = 0;
+    atomic_init(&queue->spilled, 0);
+    atomic_init(&queue->merged, 0);
+    atomic_init(&queue->dropped, 0);
+    mtx_init(&queue->lock, mtx_plain);
+    cnd_init(&queue->wake);
+}
+
+void event_queue_destroy(struct event_queue *queue) {
+    free(queue->spill);
+    cnd_destroy(&queue->wake);
+    mtx_destroy(&queue->lock);
+}
+
+static bool ring_full(struct event_queue *queue) {
+    return atomic_load_explicit(&queue->tail, memory_order_relaxed) -
+               atomic_load_explicit(&queue->head, memory_order_acquire) == EVENT_QUEUE_SIZE;
+}
+
+// producer side, the ring has room
+static void ring_push(struct event_queue *queue, const struct app_event *event) {
+    const unsigned tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    queue->events[tail & (EVENT_QUEUE_SIZE - 1)] = *event;
+    // seq_cst store pairs with the consumer's seq_cst store of sleeping: one of the two sides always sees the other
+    atomic_store(&queue->tail, tail + 1);
+}
+
+// under lock: the newest spilled event takes in motion or scroll of its own kind, false if it cannot
+static bool spill_merge(struct event_queue *queue, const struct app_event *event) {
+    if (queue->spill_count == queue->spill_head) return false;
+    struct app_event *last = &queue->spill[queue->spill_count - 1];
+    if (last->type != event->type) return false;
+    if (event->type == APP_EVENT_POINTER_MOTION) {
+        *last = *event;
+    } else if (event->type == APP_EVENT_POINTER_AXIS && last->a == event->a) {
+        const int32_t scrolled = last->b;
+        *last = *event;
+        last->b += scrolled;
+    } else {
+        return false;
+    }
+    atomic_fetch_add_explicit(&queue->merged, 1, memory_order_relaxed);
+    return true;
+}
+
+// under lock
+static bool spill_append(struct event_queue *queue, const struct app_event *event) {
+    if (queue->spill_count == queue->spill_capacity) {
+        const unsigned capacity = queue->spill_capacity ? queue->spill_capacity * 2 : 256;
+        struct app_event *spill = realloc(queue->spill, capacity * sizeof(*spill));
+        if (!spill) {
+            atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+            return false;
+        }
+        queue->spill = spill;
+        queue->spill_capacity = capacity;
+    }
+    queue->spill[queue->spill_count++] = *event;
+    return true;
+}
+
+// under lock: after the head is taken off an emptied spill list it starts over at the front
+static void spill_update(struct event_queue *queue) {
+    if (queue->spill_head == queue->spill_count) queue->spill_head = queue->spill_count = 0;
+    atomic_store_explicit(&queue->spilled, queue->spill_count - queue->spill_head, memory_order_release);
+}
+
+// the ring filled up because the consumer fell behind, the dispatch thread keeps going and the events wait in order
+static bool push_slow(struct event_queue *queue, const struct app_event *event) {
+    bool pushed = true;
+    mtx_lock(&queue->lock);
+    // spilled events are older than this one, as many as fit go into the ring first
+    while (queue->spill_head < queue->spill_count && !ring_full(queue)) {
+        ring_push(queue, &queue->spill[queue->spill_head++]);
+    }
+    if (queue->spill_head == queue->spill_count && !ring_full(queue)) ring_push(queue, event);
+    else if (!spill_merge(queue, event)) pushed = spill_append(queue, event);
+    spill_update(queue);
+    cnd_signal(&queue->wake);
+    mtx_unlock(&queue->lock);
+    return pushed;
+}
+
+bool event_queue_push(struct event_queue *queue, const struct app_event *event) {
+    if (atomic_load_explicit(&queue->spilled, memory_order_relaxed) || ring_full(queue))
+        return push_slow(queue, event);
+    ring_push(queue, event);
+    if (atomic_load(&queue->sleeping)) {
+        mtx_lock(&queue->lock);
+        cnd_signal(&queue->wake);
+        mtx_unlock(&queue->lock);
+    }
+    return true;
+}
+
+bool event_queue_pop(struct event_queue *queue, struct app_event *event) {
+    const unsigned head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    const unsigned tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+    if (head != tail) {
+        *event = queue->events[head & (EVENT_QUEUE_SIZE - 1)];
+        atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+        return true;
+    }
+    if (!atomic_load_explicit(&queue->spilled, memory_order_acquire)) return false;
+    // the ring is empty, so the oldest spilled event is the oldest left; the producer may not push again for a while
+    bool popped = false;
+    mtx_lock(&queue->lock);
+    if (queue->spill_head < queue->spill_count && atomic_load_explicit(&queue->tail, memory_order_relaxed) == head) {
+        *event = queue->spill[queue->spill_head++];
+        spill_update(queue);
+        popped = true;
+    }
+    mtx_unlock(&queue->lock);
+    // the producer moved the spill list into the ring meanwhile
+    return popped || event_queue_pop(queue, event);
+}
+
+bool event_queue_empty(struct event_queue *queue) {
+    return atomic_load_explicit(&queue->tail, memory_order_acquire) ==
+               atomic_load_explicit(&queue->head, memory_order_relaxed) &&
+           !atomic_load_explicit(&queue->spilled, memory_order_acquire) &&
+           !atomic_load_explicit(&queue->notified, memory_order_relaxed);
+}
+
+void event_queue_wait(struct event_queue *queue) {
+    mtx_lock(&queue->lock);
+    atomic_store(&queue->sleeping, true);
+    while (atomic_load(&queue->tail) == atomic_load_explicit(&queue->head, memory_order_relaxed) &&
+           !atomic_load_explicit(&queue->spilled, memory_order_relaxed) &&
+           !atomic_exchange(&queue->notified, false)) {
+        cnd_wait(&queue->wake, &queue->lock);
+    }
+    atomic_store(&queue->sleeping, false);
+    mtx_unlock(&queue->lock);
+}
+
+void event_queue_notify(struct event_queue *queue) {
+    // same handshake as a push, the flag takes the place of the tail
+    atomic_store(&queue->notified, true);
+    if (atomic_load(&queue->sleeping)) {
+        mtx_lock(&queue->lock);
+        cnd_signal(&queue->wake);
+        mtx_unlock(&queue->lock);
+    }
+}
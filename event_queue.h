@@ -0,0 +1,70 @@
+#ifndef EVENT_QUEUE_H
+#define EVENT_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tinycthread/tinycthread.h"
+
+// events handed from the wayland dispatch thread to the render thread
+enum app_event_type {
+    APP_EVENT_POINTER_MOTION,  // a, b = surface position in wl_fixed_t
+    APP_EVENT_POINTER_BUTTON,  // a = button, b = state
+    APP_EVENT_POINTER_AXIS,    // a = axis, b = value in wl_fixed_t
+    APP_EVENT_CONFIGURE,       // serial = xdg_surface configure serial
+    APP_EVENT_TOPLEVEL_SIZE,   // a, b = suggested width and height
+    APP_EVENT_FRAME_DONE,      // frame callback fired
+    APP_EVENT_BUFFER_RELEASE,  // a = index of the buffer the compositor released
+    APP_EVENT_CLOSE,
+    APP_EVENT_SCALE,           // a = preferred buffer scale in 120ths
+    APP_EVENT_KEY,             // a = xkb keysym of a key press, b = the utf-32 character it types, 0 if none
+    APP_EVENT_CURSOR_BLINK,    // a = 1 to show the text cursor, 0 to hide it
+    APP_EVENT_LOADER_READY,    // reads of the io_uring loader completed
+};
+
+struct app_event {
+    uint32_t type;
+    uint32_t time;          // wayland event time in ms, if the event has one
+    uint32_t serial;
+    int32_t a, b;
+    uint64_t timestamp_ns;  // when the dispatch thread received it
+};
+
+// single producer single consumer ring, pushing and popping never takes a lock while there is room
+// the lock and condition are only used to put an idle consumer to sleep, and for the spill list
+#define EVENT_QUEUE_SIZE 1024 // power of two
+
+struct event_queue {
+    struct app_event events[EVENT_QUEUE_SIZE];
+    _Alignas(64) atomic_uint head; // next slot to pop, written by the consumer
+    _Alignas(64) atomic_uint tail; // next slot to push, written by the producer
+    atomic_bool sleeping;
+    atomic_bool notified;          // set by event_queue_notify, cleared by the consumer's wait
+    // events that came in while the ring was full, in order and all newer than the ring's; under lock
+    // the producer moves them into the ring as room appears, the consumer takes them once the ring is empty
+    struct app_event *spill;
+    unsigned spill_head, spill_count, spill_capacity;
+    atomic_uint spilled;           // spill_count - spill_head, for checks without the lock
+    atomic_uint merged;            // motion and scroll events merged into a spilled one
+    atomic_uint dropped;           // events lost because the spill list could not grow
+    mtx_t lock;
+    cnd_t wake;
+};
+
+void event_queue_init(struct event_queue *queue);
+void event_queue_destroy(struct event_queue *queue);
+// producer side, never blocks on the consumer: with a full ring the event goes to the spill list
+// pointer motion and scroll are merged into the newest spilled event of the same kind
+// returns false only if the spill list could not grow and the event was dropped
+bool event_queue_push(struct event_queue *queue, const struct app_event *event);
+// consumer side
+bool event_queue_pop(struct event_queue *queue, struct app_event *event);
+// consumer side: true if a pop or a wait would find nothing
+bool event_queue_empty(struct event_queue *queue);
+// blocks the consumer until there is at least one event or a notify
+void event_queue_wait(struct event_queue *queue);
+// any thread: wakes the consumer without an event, e.g. when work it handed off has finished
+void event_queue_notify(struct event_queue *queue);
+
+#endif
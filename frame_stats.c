@@ -0,0 +1,17 @@
+#include <string.h>
+
+#include "frame_stats.h"
+
+struct frame_stats frame_stats;
+
+void frame_stats_begin(void) {
+    frame_stats.frame++;
+    frame_stats.upload_bytes = 0;
+    frame_stats.upload_ns = 0;
+}
+
+void frame_stats_print(FILE *out) {
+    fprintf(out, "Frame %lu: uploaded %lu bytes in %lu microseconds (%u stream wraps)\n",
+            (unsigned long) frame_stats.frame, (unsigned long) frame_stats.upload_bytes,
+            (unsigned long) (frame_stats.upload_ns / 1000), frame_stats.stream_wraps);
+}
@@ -0,0 +1,20 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// counters for the frame being produced, reset by frame_stats_begin
+struct frame_stats {
+    uint64_t frame;        // frames begun so far
+    uint64_t upload_bytes; // vertex data uploaded this frame
+    uint64_t upload_ns;    // time spent uploading it
+    uint32_t stream_wraps; // times the vertex stream wrapped (and was orphaned) since startup
+};
+
+extern struct frame_stats frame_stats;
+
+void frame_stats_begin(void);
+void frame_stats_print(FILE *out);
+
+#endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include "glyph.h"
+#include "thread_pool.h"
+#include "arena.h"
+
+// built-in 8x8 bitmap font for printable ascii (public domain font8x8_basic), bit 0 is the leftmost pixel
+static const uint8_t font8x8[95][8] = {
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+    {0x18, 0x3C, 0x3C, 0x18, 0x18, 0x00, 0x18, 0x00}, // '!'
+    {0x36, 0x36, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '"'
+    {0x36, 0x36, 0x7F, 0x36, 0x7F, 0x36, 0x36, 0x00}, // '#'
+    {0x0C, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x0C, 0x00}, // '$'
+    {0x00, 0x63, 0x33, 0x18, 0x0C, 0x66, 0x63, 0x00}, // '%'
+    {0x1C, 0x36, 0x1C, 0x6E, 0x3B, 0x33, 0x6E, 0x00}, // '&'
+    {0x06, 0x06, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00}, // '''
+    {0x18, 0x0C, 0x06, 0x06, 0x06, 0x0C, 0x18, 0x00}, // '('
+    {0x06, 0x0C, 0x18, 0x18, 0x18, 0x0C, 0x06, 0x00}, // ')'
+    {0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00}, // '*'
+    {0x00, 0x0C, 0x0C, 0x3F, 0x0C, 0x0C, 0x00, 0x00}, // '+'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x06}, // ','
+    {0x00, 0x00, 0x00, 0x3F, 0x00, 0x00, 0x00, 0x00}, // '-'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C, 0x00}, // '.'
+    {0x60, 0x30, 0x18, 0x0C, 0x06, 0x03, 0x01, 0x00}, // '/'
+    {0x3E, 0x63, 0x73, 0x7B, 0x6F, 0x67, 0x3E, 0x00}, // '0'
+    {0x0C, 0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x3F, 0x00}, // '1'
+    {0x1E, 0x33, 0x30, 0x1C, 0x06, 0x33, 0x3F, 0x00}, // '2'
+    {0x1E, 0x33, 0x30, 0x1C, 0x30, 0x33, 0x1E, 0x00}, // '3'
+    {0x38, 0x3C, 0x36, 0x33, 0x7F, 0x30, 0x78, 0x00}, // '4'
+    {0x3F, 0x03, 0x1F, 0x30, 0x30, 0x33, 0x1E, 0x00}, // '5'
+    {0x1C, 0x06, 0x03, 0x1F, 0x33, 0x33, 0x1E, 0x00}, // '6'
+    {0x3F, 0x33, 0x30, 0x18, 0x0C, 0x0C, 0x0C, 0x00}, // '7'
+    {0x1E, 0x33, 0x33, 0x1E, 0x33, 0x33, 0x1E, 0x00}, // '8'
+    {0x1E, 0x33, 0x33, 0x3E, 0x30, 0x18, 0x0E, 0x00}, // '9'
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x00}, // ':'
+    {0x00, 0x0C, 0x0C, 0x00, 0x00, 0x0C, 0x0C, 0x06}, // ';'
+    {0x18, 0x0C, 0x06, 0x03, 0x06, 0x0C, 0x18, 0x00}, // '<'
+    {0x00, 0x00, 0x3F, 0x00, 0x00, 0x3F, 0x00, 0x00}, // '='
+    {0x06, 0x0C, 0x18, 0x30, 0x18, 0x0C, 0x06, 0x00}, // '>'
+    {0x1E, 0x33, 0x30, 0x18, 0x0C, 0x00, 0x0C, 0x00}, // '?'
+    {0x3E, 0x63, 0x7B, 0x7B, 0x7B, 0x03, 0x1E, 0x00}, // '@'
+    {0x0C, 0x1E, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x00}, // 'A'
+    {0x3F, 0x66, 0x66, 0x3E, 0x66, 0x66, 0x3F, 0x00}, // 'B'
+    {0x3C, 0x66, 0x03, 0x03, 0x03, 0x66, 0x3C, 0x00}, // 'C'
+    {0x1F, 0x36, 0x66, 0x66, 0x66, 0x36, 0x1F, 0x00}, // 'D'
+    {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x46, 0x7F, 0x00}, // 'E'
+    {0x7F, 0x46, 0x16, 0x1E, 0x16, 0x06, 0x0F, 0x00}, // 'F'
+    {0x3C, 0x66, 0x03, 0x03, 0x73, 0x66, 0x7C, 0x00}, // 'G'
+    {0x33, 0x33, 0x33, 0x3F, 0x33, 0x33, 0x33, 0x00}, // 'H'
+    {0x1E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'I'
+    {0x78, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E, 0x00}, // 'J'
+    {0x67, 0x66, 0x36, 0x1E, 0x36, 0x66, 0x67, 0x00}, // 'K'
+    {0x0F, 0x06, 0x06, 0x06, 0x46, 0x66, 0x7F, 0x00}, // 'L'
+    {0x63, 0x77, 0x7F, 0x7F, 0x6B, 0x63, 0x63, 0x00}, // 'M'
+    {0x63, 0x67, 0x6F, 0x7B, 0x73, 0x63, 0x63, 0x00}, // 'N'
+    {0x1C, 0x36, 0x63, 0x63, 0x63, 0x36, 0x1C, 0x00}, // 'O'
+    {0x3F, 0x66, 0x66, 0x3E, 0x06, 0x06, 0x0F, 0x00}, // 'P'
+    {0x1E, 0x33, 0x33, 0x33, 0x3B, 0x1E, 0x38, 0x00}, // 'Q'
+    {0x3F, 0x66, 0x66, 0x3E, 0x36, 0x66, 0x67, 0x00}, // 'R'
+    {0x1E, 0x33, 0x07, 0x0E, 0x38, 0x33, 0x1E, 0x00}, // 'S'
+    {0x3F, 0x2D, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'T'
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x3F, 0x00}, // 'U'
+    {0x33, 0x33, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00}, // 'V'
+    {0x63, 0x63, 0x63, 0x6B, 0x7F, 0x77, 0x63, 0x00}, // 'W'
+    {0x63, 0x63, 0x36, 0x1C, 0x1C, 0x36, 0x63, 0x00}, // 'X'
+    {0x33, 0x33, 0x33, 0x1E, 0x0C, 0x0C, 0x1E, 0x00}, // 'Y'
+    {0x7F, 0x63, 0x31, 0x18, 0x4C, 0x66, 0x7F, 0x00}, // 'Z'
+    {0x1E, 0x06, 0x06, 0x06, 0x06, 0x06, 0x1E, 0x00}, // '['
+    {0x03, 0x06, 0x0C, 0x18, 0x30, 0x60, 0x40, 0x00}, // '\'
+    {0x1E, 0x18, 0x18, 0x18, 0x18, 0x18, 0x1E, 0x00}, // ']'
+    {0x08, 0x1C, 0x36, 0x63, 0x00, 0x00, 0x00, 0x00}, // '^'
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFF}, // '_'
+    {0x0C, 0x0C, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00}, // '`'
+    {0x00, 0x00, 0x1E, 0x30, 0x3E, 0x33, 0x6E, 0x00}, // 'a'
+    {0x07, 0x06, 0x06, 0x3E, 0x66, 0x66, 0x3B, 0x00}, // 'b'
+    {0x00, 0x00, 0x1E, 0x33, 0x03, 0x33, 0x1E, 0x00}, // 'c'
+    {0x38, 0x30, 0x30, 0x3E, 0x33, 0x33, 0x6E, 0x00}, // 'd'
+    {0x00, 0x00, 0x1E, 0x33, 0x3F, 0x03, 0x1E, 0x00}, // 'e'
+    {0x1C, 0x36, 0x06, 0x0F, 0x06, 0x06, 0x0F, 0x00}, // 'f'
+    {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x1F}, // 'g'
+    {0x07, 0x06, 0x36, 0x6E, 0x66, 0x66, 0x67, 0x00}, // 'h'
+    {0x0C, 0x00, 0x0E, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'i'
+    {0x30, 0x00, 0x30, 0x30, 0x30, 0x33, 0x33, 0x1E}, // 'j'
+    {0x07, 0x06, 0x66, 0x36, 0x1E, 0x36, 0x67, 0x00}, // 'k'
+    {0x0E, 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x1E, 0x00}, // 'l'
+    {0x00, 0x00, 0x33, 0x7F, 0x7F, 0x6B, 0x63, 0x00}, // 'm'
+    {0x00, 0x00, 0x1F, 0x33, 0x33, 0x33, 0x33, 0x00}, // 'n'
+    {0x00, 0x00, 0x1E, 0x33, 0x33, 0x33, 0x1E, 0x00}, // 'o'
+    {0x00, 0x00, 0x3B, 0x66, 0x66, 0x3E, 0x06, 0x0F}, // 'p'
+    {0x00, 0x00, 0x6E, 0x33, 0x33, 0x3E, 0x30, 0x78}, // 'q'
+    {0x00, 0x00, 0x3B, 0x6E, 0x66, 0x06, 0x0F, 0x00}, // 'r'
+    {0x00, 0x00, 0x3E, 0x03, 0x1E, 0x30, 0x1F, 0x00}, // 's'
+    {0x08, 0x0C, 0x3E, 0x0C, 0x0C, 0x2C, 0x18, 0x00}, // 't'
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x33, 0x6E, 0x00}, // 'u'
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x1E, 0x0C, 0x00}, // 'v'
+    {0x00, 0x00, 0x63, 0x6B, 0x7F, 0x7F, 0x36, 0x00}, // 'w'
+    {0x00, 0x00, 0x63, 0x36, 0x1C, 0x36, 0x63, 0x00}, // 'x'
+    {0x00, 0x00, 0x33, 0x33, 0x33, 0x3E, 0x30, 0x1F}, // 'y'
+    {0x00, 0x00, 0x3F, 0x19, 0x0C, 0x26, 0x3F, 0x00}, // 'z'
+    {0x38, 0x0C, 0x0C, 0x07, 0x0C, 0x0C, 0x38, 0x00}, // '{'
+    {0x18, 0x18, 0x18, 0x00, 0x18, 0x18, 0x18, 0x00}, // '|'
+    {0x07, 0x0C, 0x0C, 0x38, 0x0C, 0x0C, 0x07, 0x00}, // '}'
+    {0x6E, 0x3B, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // '~'
+};
+// drawn for code points the font does not have
+static const uint8_t font8x8_missing[8] = {0x00, 0x3E, 0x22, 0x22, 0x22, 0x22, 0x3E, 0x00};
+
+struct glyph_atlas glyph_atlas;
+struct glyph glyphs[GLYPH_MAX];
+struct glyph_cache_stats glyph_cache_stats;
+static atomic_uint glyph_count = 0;
+
+// open addressed, a slot holds key << 32 | id and is published with a single CAS, 0 is an empty slot
+// key is codepoint << 8 | size, never 0 because size is never 0
+// a slot whose id is GLYPH_PENDING is being rasterized by the thread that claimed it
+#define GLYPH_TABLE_SIZE (GLYPH_MAX * 2)
+#define GLYPH_PENDING UINT32_MAX
+static _Atomic uint64_t glyph_table[GLYPH_TABLE_SIZE];
+
+// glyphs rasterized since the last glyph_commit, one stage per thread so a miss never waits for another thread
+// a stage is a frame arena of staged glyphs back to back, glyph_commit empties it with a reset
+struct glyph_stage {
+    struct glyph_stage *next; // list of all stages, walked by glyph_commit
+    struct arena arena;
+    int count;
+};
+
+struct staged_glyph {
+    uint32_t id;
+    uint8_t pixels[]; // size * size coverage
+};
+
+// more than the atlas can take, whatever does not fit is dropped by glyph_commit anyway
+#define GLYPH_STAGE_RESERVE (4 * GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE)
+
+static _Atomic(struct glyph_stage *) glyph_stages;
+static tss_t glyph_stage_key;
+static once_flag glyph_once = ONCE_FLAG_INIT;
+
+int glyph_advance(int size_px) {
+    return size_px;
+}
+
+int glyph_line_height(int size_px) {
+    return size_px + size_px / 4;
+}
+
+bool glyph_rasterize(uint32_t codepoint, int size_px, uint8_t *out, int stride) {
+    const bool found = codepoint >= 0x20 && codepoint <= 0x7E;
+    const uint8_t *bitmap = found ? font8x8[codepoint - 0x20] : font8x8_missing;
+    // box filter the 8x8 bitmap with 4x4 samples per target pixel, gives grayscale AA at any size
+    for (int y = 0; y < size_px; y++) {
+        for (int x = 0; x < size_px; x++) {
+            int hits = 0;
+            for (int sy = 0; sy < 4; sy++) {
+                const int by = ((y * 4 + sy) * 8) / (size_px * 4);
+                for (int sx = 0; sx < 4; sx++) {
+                    const int bx = ((x * 4 + sx) * 8) / (size_px * 4);
+                    hits += (bitmap[by] >> bx) & 1;
+                }
+            }
+            out[y * stride + x] = hits * 255 / 16;
+        }
+    }
+    return found;
+}
+
+// shelf packing: glyphs fill rows left to right, a new shelf starts below the tallest glyph of the row
+static bool atlas_alloc(int w, int h, int *x, int *y) {
+    struct glyph_atlas *atlas = &glyph_atlas;
+    if (atlas->shelf_x + w > GLYPH_ATLAS_SIZE) {
+        atlas->shelf_y += atlas->shelf_h;
+        atlas->shelf_x = 0;
+        atlas->shelf_h = 0;
+    }
+    if (atlas->shelf_y + h > GLYPH_ATLAS_SIZE) return false;
+    *x = atlas->shelf_x;
+    *y = atlas->shelf_y;
+    atlas->shelf_x += w + 1; // 1 px gap so bilinear sampling never bleeds into a neighbour
+    if (h + 1 > atlas->shelf_h) atlas->shelf_h = h + 1;
+    return true;
+}
+
+static void atlas_mark_dirty(int y0, int y1) {
+    struct glyph_atlas *atlas = &glyph_atlas;
+    if (atlas->dirty_y1 <= atlas->dirty_y0) {
+        atlas->dirty_y0 = y0;
+        atlas->dirty_y1 = y1;
+    } else {
+        if (y0 < atlas->dirty_y0) atlas->dirty_y0 = y0;
+        if (y1 > atlas->dirty_y1) atlas->dirty_y1 = y1;
+    }
+    atlas->generation++;
+}
+
+static void glyph_init(void) {
+    int x, y;
+    atlas_alloc(4, 4, &x, &y);
+    for (int row = 0; row < 4; row++) memset(&glyph_atlas.pixels[(y + row) * GLYPH_ATLAS_SIZE + x], 0xFF, 4);
+    atlas_mark_dirty(y, y + 4);
+    glyphs[GLYPH_SOLID] = (struct glyph){0, 0, x, y, 4, 4, 0};
+    tss_create(&glyph_stage_key, NULL);
+    glyph_count = 1;
+}
+
+static uint32_t glyph_hash(uint32_t codepoint, int size_px) {
+    return (codepoint * 2654435761u) ^ (size_px * 40503u);
+}
+
+static struct glyph_stage *glyph_stage(void) {
+    struct glyph_stage *stage = tss_get(glyph_stage_key);
+    if (stage) return stage;
+    stage = calloc(1, sizeof(*stage));
+    if (!stage) return NULL;
+    if (!arena_init(&stage->arena, GLYPH_STAGE_RESERVE)) {
+        free(stage);
+        return NULL;
+    }
+    stage->next = atomic_load(&glyph_stages);
+    while (!atomic_compare_exchange_weak(&glyph_stages, &stage->next, stage)) {
+    }
+    tss_set(glyph_stage_key, stage);
+    return stage;
+}
+
+// rasterizes into the calling thread's stage, returns false if out of memory
+static bool glyph_stage_push(uint32_t id, uint32_t codepoint, int size_px) {
+    struct glyph_stage *stage = glyph_stage();
+    if (!stage) return false;
+    struct staged_glyph *staged = arena_alloc(&stage->arena, sizeof(*staged) + (size_t) size_px * size_px,
+                                              _Alignof(struct staged_glyph));
+    if (!staged) return false;
+    staged->id = id;
+    glyph_rasterize(codepoint, size_px, staged->pixels, size_px);
+    stage->count++;
+    return true;
+}
+
+uint32_t glyph_lookup(uint32_t codepoint, int size_px) {
+    call_once(&glyph_once, glyph_init);
+    if (size_px <= 0 || size_px > 255) return GLYPH_SOLID;
+    const uint64_t key = (uint64_t) (codepoint << 8 | size_px) << 32;
+    uint32_t slot = glyph_hash(codepoint, size_px) & (GLYPH_TABLE_SIZE - 1);
+    for (int probe = 0; probe < GLYPH_TABLE_SIZE; probe++, slot = (slot + 1) & (GLYPH_TABLE_SIZE - 1)) {
+        uint64_t entry = atomic_load_explicit(&glyph_table[slot], memory_order_acquire);
+        if (entry == 0) {
+            // miss: claim the slot, only the thread that wins the CAS rasterizes
+            if (atomic_load_explicit(&glyph_count, memory_order_relaxed) >= GLYPH_MAX) break;
+            if (!atomic_compare_exchange_strong_explicit(&glyph_table[slot], &entry, key | GLYPH_PENDING,
+                                                         memory_order_acq_rel, memory_order_acquire)) {
+                // lost the race for this slot, entry now holds whatever won
+                atomic_fetch_add_explicit(&glyph_cache_stats.cas_failures, 1, memory_order_relaxed);
+            } else {
+                atomic_fetch_add_explicit(&glyph_cache_stats.misses, 1, memory_order_relaxed);
+                uint32_t id = atomic_fetch_add_explicit(&glyph_count, 1, memory_order_relaxed);
+                if (id >= GLYPH_MAX) {
+                    id = GLYPH_SOLID;
+                } else {
+                    // no atlas rect yet, glyph_commit places it
+                    glyphs[id] = (struct glyph){codepoint, size_px, 0, 0, 0, 0, glyph_advance(size_px)};
+                    if (!glyph_stage_push(id, codepoint, size_px)) id = GLYPH_SOLID;
+                }
+                atomic_store_explicit(&glyph_table[slot], key | id, memory_order_release);
+                return id;
+            }
+        }
+        if ((entry & 0xFFFFFFFF00000000u) != key) continue;
+        // another thread is rasterizing this glyph, it takes microseconds
+        if ((uint32_t) entry == GLYPH_PENDING) {
+            atomic_fetch_add_explicit(&glyph_cache_stats.pending_waits, 1, memory_order_relaxed);
+            do {
+                thrd_yield();
+                entry = atomic_load_explicit(&glyph_table[slot], memory_order_acquire);
+            } while ((uint32_t) entry == GLYPH_PENDING);
+        }
+        atomic_fetch_add_explicit(&glyph_cache_stats.hits, 1, memory_order_relaxed);
+        return (uint32_t) entry;
+    }
+    fprintf(stderr, "Glyph cache full, dropping U+%04X\n", codepoint);
+    return GLYPH_SOLID;
+}
+
+bool glyph_commit(void) {
+    call_once(&glyph_once, glyph_init);
+    bool placed = false;
+    for (struct glyph_stage *stage = atomic_load(&glyph_stages); stage; stage = stage->next) {
+        size_t offset = 0;
+        for (int i = 0; i < stage->count; i++) {
+            offset = (offset + _Alignof(struct staged_glyph) - 1) & ~(_Alignof(struct staged_glyph) - 1);
+            const struct staged_glyph *staged = (const struct staged_glyph *) (stage->arena.base + offset);
+            struct glyph *glyph = &glyphs[staged->id];
+            const int size = glyph->size;
+            offset += sizeof(*staged) + (size_t) size * size;
+            int x, y;
+            if (!atlas_alloc(size, size, &x, &y)) {
+                // stays an empty glyph: advances but draws nothing
+                fprintf(stderr, "Glyph atlas full, dropping U+%04X\n", glyph->codepoint);
+                continue;
+            }
+            for (int row = 0; row < size; row++) {
+                memcpy(&glyph_atlas.pixels[(y + row) * GLYPH_ATLAS_SIZE + x], staged->pixels + row * size, size);
+            }
+            glyph->atlas_x = x;
+            glyph->atlas_y = y;
+            glyph->w = glyph->h = size;
+            atlas_mark_dirty(y, y + size);
+            placed = true;
+        }
+        stage->count = 0;
+        arena_reset(&stage->arena);
+    }
+    return placed;
+}
+
+struct prewarm {
+    const uint32_t *codepoints;
+    int size_px;
+};
+
+static void prewarm_range(void *arg, int begin, int end) {
+    const struct prewarm *prewarm = arg;
+    for (int i = begin; i < end; i++) glyph_lookup(prewarm->codepoints[i], prewarm->size_px);
+}
+
+void glyph_prewarm(struct thread_pool *pool, const uint32_t *codepoints, int count, int size_px) {
+    // the workers look up concurrently, misses land in their own stages and are placed in one go
+    struct prewarm prewarm = {codepoints, size_px};
+    parallel_for(pool, 0, count, 16, prewarm_range, &prewarm);
+    glyph_commit();
+}
@@ -0,0 +1,58 @@
+#ifndef GLYPH_H
+#define GLYPH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// glyphs are rasterized once into a single A8 atlas and referred to by id from then on
+#define GLYPH_ATLAS_SIZE 1024
+#define GLYPH_MAX 4096
+// id 0 is a fully covered texel block, used by backends that draw rects through the atlas
+#define GLYPH_SOLID 0
+
+struct glyph {
+    uint32_t codepoint;
+    uint16_t size;             // pixel height the glyph was rasterized at
+    uint16_t atlas_x, atlas_y; // top left in the atlas
+    uint8_t w, h;              // bitmap size
+    uint8_t advance;           // pen advance in pixels
+};
+
+struct glyph_atlas {
+    uint8_t pixels[GLYPH_ATLAS_SIZE * GLYPH_ATLAS_SIZE]; // coverage, 0..255
+    int shelf_x, shelf_y, shelf_h;                      // shelf packer state
+    int dirty_y0, dirty_y1;                             // rows written since the last upload
+    uint32_t generation;                                // bumped on every write
+};
+
+// cache counters, relaxed atomics that only ever grow
+struct glyph_cache_stats {
+    atomic_ulong hits;
+    atomic_ulong misses;        // lookups that rasterized
+    atomic_ulong pending_waits; // hits on a glyph another thread was still rasterizing
+    atomic_ulong cas_failures;  // slot claims lost to another thread
+};
+
+extern struct glyph_atlas glyph_atlas;
+extern struct glyph glyphs[GLYPH_MAX];
+extern struct glyph_cache_stats glyph_cache_stats;
+
+struct thread_pool;
+
+// returns the id of the glyph for codepoint at size_px, safe to call from any number of threads at once
+// size_px is in device pixels (font size times output scale), so glyphs of differently scaled views never mix
+// hits take no lock, a miss rasterizes into a per-thread stage and is not in the atlas until glyph_commit
+uint32_t glyph_lookup(uint32_t codepoint, int size_px);
+// frame boundary: places every staged glyph in the atlas, returns true if the atlas changed
+// must not run concurrently with glyph_lookup or with anything reading the new glyphs
+bool glyph_commit(void);
+// looks up codepoints at size_px on the pool and commits, so the lookups that follow are all hits
+void glyph_prewarm(struct thread_pool *pool, const uint32_t *codepoints, int count, int size_px);
+// monospace metrics of the built-in font
+int glyph_advance(int size_px);
+int glyph_line_height(int size_px);
+// rasterizes the coverage of a glyph into out (size_px x size_px), returns false if the font has no such glyph
+bool glyph_rasterize(uint32_t codepoint, int size_px, uint8_t *out, int stride);
+
+#endif
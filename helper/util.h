@@ -0,0 +1,13 @@
+#ifndef HELPER_UTIL_H
+#define HELPER_UTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hud.h"
+#include "glyph.h"
+
+#define HUD_FONT_SIZE 8
+#define HUD_BACKGROUND 0xFF101010
+#define HUD_FOREGROUND 0xFF7FFF7F
+
+void hud_frame_done(struct hud *hud, uint64_t done_ns, uint64_t commit_ns, bool next_ready) {
+    if (hud->next_ready) {
+        hud->frame_ns[hud->interval_count & (HUD_HISTORY - 1)] = done_ns - hud->last_done_ns;
+        hud->interval_count++;
+    }
+    hud->latency_ns[hud->count & (HUD_HISTORY - 1)] = done_ns - commit_ns;
+    hud->last_done_ns = done_ns;
+    hud->next_ready = next_ready;
+    hud->count++;
+}
+
+void hud_damage(struct hud *hud, uint64_t pixels) {
+    hud->damaged_pixels = pixels;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    const uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// percentile p (0..100) of the frames in the history
+static uint64_t percentile(const uint64_t *values, uint32_t count, int p) {
+    uint64_t sorted[HUD_HISTORY];
+    const uint32_t n = count < HUD_HISTORY ? count : HUD_HISTORY;
+    if (n == 0) return 0;
+    memcpy(sorted, values, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), compare_u64);
+    return sorted[(n - 1) * p / 100];
+}
+
+static void hud_text(struct draw_list *list, int y, const char *text) {
+    const int advance = glyph_advance(HUD_FONT_SIZE);
+    dl_glyphs_begin(list, 4, y, HUD_FOREGROUND);
+    for (int i = 0; text[i]; i++) {
+        if (text[i] != ' ') dl_glyph(list, glyph_lookup((uint8_t) text[i], HUD_FONT_SIZE), i * advance);
+    }
+}
+
+bool hud_update(struct hud *hud) {
+    const uint32_t last = (hud->interval_count - 1) & (HUD_HISTORY - 1);
+    const uint64_t hits = glyph_cache_stats.hits, misses = glyph_cache_stats.misses;
+    // hit rate since the last update, so a burst of misses shows up instead of vanishing in the total
+    const uint64_t lookups = hits - hud->shown_hits + misses - hud->shown_misses;
+    const double hit_rate = lookups ? 100.0 * (hits - hud->shown_hits) / lookups : 100.0;
+    hud->shown_hits = hits;
+    hud->shown_misses = misses;
+    char line[4][40];
+    snprintf(line[0], sizeof(line[0]), "frame %5.2f ms p99 %5.2f", hud->interval_count ? hud->frame_ns[last] / 1e6 : 0.0,
+             percentile(hud->frame_ns, hud->interval_count, 99) / 1e6);
+    snprintf(line[1], sizeof(line[1]), "latency p99 %6.2f ms", percentile(hud->latency_ns, hud->count, 99) / 1e6);
+    snprintf(line[2], sizeof(line[2]), "glyph hits %5.1f%%", hit_rate);
+    snprintf(line[3], sizeof(line[3]), "damage %9lu px", (unsigned long) hud->damaged_pixels);
+
+    struct draw_list *list = &hud->list;
+    dl_reset(list);
+    dl_rect(list, 0, 0, HUD_WIDTH, HUD_HEIGHT, HUD_BACKGROUND);
+    const int line_height = glyph_line_height(HUD_FONT_SIZE) + 2;
+    for (int i = 0; i < 4; i++) hud_text(list, 4 + i * line_height, line[i]);
+    glyph_commit();
+    return dl_finish(list);
+}
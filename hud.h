@@ -0,0 +1,34 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "draw_list.h"
+
+// frame statistics overlay, recorded as a draw list so any backend can show it
+// the app draws it into its own subsurface, updating it never touches the main surface
+#define HUD_HISTORY 128 // frames kept for the percentiles, power of two
+#define HUD_WIDTH 224
+#define HUD_HEIGHT 64
+
+struct hud {
+    uint64_t frame_ns[HUD_HISTORY];   // time between frame callbacks of back to back frames
+    uint64_t latency_ns[HUD_HISTORY]; // commit to frame callback
+    uint32_t count;                   // frames recorded so far
+    uint32_t interval_count;          // frame_ns entries recorded so far
+    uint64_t last_done_ns;
+    bool next_ready;                  // the next frame was already on its way at the last frame callback
+    uint64_t damaged_pixels;          // damage of the last commit
+    uint64_t shown_hits, shown_misses; // glyph cache counters at the last recording
+    struct draw_list list;
+};
+
+// call from the frame callback, next_ready tells if the next frame is already laid out, rasterizing or rasterized
+// only then does the time to the following callback measure a frame, otherwise it includes the app waiting for input
+void hud_frame_done(struct hud *hud, uint64_t done_ns, uint64_t commit_ns, bool next_ready);
+void hud_damage(struct hud *hud, uint64_t pixels);
+// records the overlay into hud->list, returns false if the text did not change
+bool hud_update(struct hud *hud);
+
+#endif
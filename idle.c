@@ -0,0 +1,61 @@
+#include "idle.h"
+#include "helper/util.h"
+
+void idle_init(struct idle_scheduler *idle) {
+    *idle = (struct idle_scheduler){0};
+    idle->interval_ns = 16666667; // 60 Hz until measured
+}
+
+void idle_add(struct idle_scheduler *idle, idle_fn fn, void *arg) {
+    for (int i = 0; i < idle->count; i++) {
+        if (idle->tasks[i].fn == fn && idle->tasks[i].arg == arg) {
+            idle->tasks[i].active = true;
+            return;
+        }
+    }
+    if (idle->count == IDLE_MAX_TASKS) return;
+    idle->tasks[idle->count++] = (struct idle_task){fn, arg, true};
+}
+
+bool idle_has_work(const struct idle_scheduler *idle) {
+    for (int i = 0; i < idle->count; i++) {
+        if (idle->tasks[i].active) return true;
+    }
+    return false;
+}
+
+void idle_frame_done(struct idle_scheduler *idle, uint64_t now_ns) {
+    const uint64_t delta = now_ns - idle->last_done_ns;
+    // gaps longer than 100 ms are pauses in drawing, not the refresh rate
+    if (idle->last_done_ns && delta > 2 * IDLE_MARGIN_NS && delta < 100000000) {
+        idle->interval_ns = (idle->interval_ns * 7 + delta) / 8;
+    }
+    idle->last_done_ns = now_ns;
+}
+
+uint64_t idle_deadline(const struct idle_scheduler *idle, uint64_t now_ns) {
+    const uint64_t next = idle->last_done_ns + idle->interval_ns;
+    // no frame expected: nothing to make way for, but still return now and then so the caller can check for input
+    if (now_ns >= next) return now_ns + idle->interval_ns - IDLE_MARGIN_NS;
+    return next - IDLE_MARGIN_NS > now_ns ? next - IDLE_MARGIN_NS : now_ns;
+}
+
+bool idle_run(struct idle_scheduler *idle, uint64_t deadline_ns, bool (*interrupted)(void *arg), void *arg) {
+    const uint64_t start = get_time_ns();
+    uint64_t now = start;
+    while (now < deadline_ns && idle_has_work(idle)) {
+        if (interrupted && interrupted(arg)) {
+            idle->interrupted++;
+            break;
+        }
+        // round robin, so one long task cannot starve the others
+        struct idle_task *task = &idle->tasks[idle->next];
+        idle->next = (idle->next + 1) % idle->count;
+        if (!task->active) continue;
+        task->active = task->fn(task->arg);
+        idle->slices++;
+        now = get_time_ns();
+    }
+    idle->used_ns += now - start;
+    return idle_has_work(idle);
+}
@@ -0,0 +1,47 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// runs low priority work in whatever is left of a frame interval after the commit
+// work is split in slices that each take well under a millisecond, between slices the caller can interrupt
+// so input that arrives meanwhile waits at most one slice
+
+// does one slice of work, returns false once there is nothing left to do
+typedef bool (*idle_fn)(void *arg);
+
+#define IDLE_MAX_TASKS 8
+#define IDLE_MARGIN_NS 2000000ull // kept free before the expected next frame
+
+struct idle_task {
+    idle_fn fn;
+    void *arg;
+    bool active;
+};
+
+struct idle_scheduler {
+    struct idle_task tasks[IDLE_MAX_TASKS];
+    int count;
+    int next;             // round robin position
+    uint64_t interval_ns; // frame interval, averaged over frame callbacks
+    uint64_t last_done_ns;
+    // totals since startup
+    uint64_t used_ns;
+    uint64_t slices;
+    uint64_t interrupted; // runs cut short by input
+};
+
+void idle_init(struct idle_scheduler *idle);
+// adds fn, or wakes it up again if it is already known and ran out of work
+void idle_add(struct idle_scheduler *idle, idle_fn fn, void *arg);
+bool idle_has_work(const struct idle_scheduler *idle);
+// call from the frame callback, keeps the frame interval estimate up to date
+void idle_frame_done(struct idle_scheduler *idle, uint64_t now_ns);
+// when idle work has to be out of the way for the next frame
+uint64_t idle_deadline(const struct idle_scheduler *idle, uint64_t now_ns);
+// runs slices until the deadline passes, the work runs out or interrupted(arg) returns true
+// returns true if work is left
+bool idle_run(struct idle_scheduler *idle, uint64_t deadline_ns, bool (*interrupted)(void *arg), void *arg);
+
+#endif
@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "input_trace.h"
+
+#define RECORD_SIZE 17
+
+bool input_trace_is_input(const struct app_event *event) {
+    return event->type == APP_EVENT_POINTER_MOTION || event->type == APP_EVENT_POINTER_BUTTON ||
+           event->type == APP_EVENT_POINTER_AXIS || event->type == APP_EVENT_KEY;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+bool input_trace_open(struct input_trace_writer *writer, const char *path) {
+    memset(writer, 0, sizeof(*writer));
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    fwrite(INPUT_TRACE_MAGIC, 8, 1, writer->file);
+    return true;
+}
+
+void input_trace_write(struct input_trace_writer *writer, const struct app_event *event) {
+    if (!writer->file || !input_trace_is_input(event)) return;
+    const uint64_t delta = writer->count ? event->timestamp_ns - writer->last_ns : 0;
+    const uint64_t delta_us = delta / 1000 > UINT32_MAX ? UINT32_MAX : delta / 1000;
+    uint8_t record[RECORD_SIZE];
+    record[0] = event->type;
+    put_u32(record + 1, delta_us);
+    put_u32(record + 5, event->time);
+    put_u32(record + 9, event->a);
+    put_u32(record + 13, event->b);
+    // buffered, the dispatch thread only pays for a memcpy most of the time
+    fwrite(record, RECORD_SIZE, 1, writer->file);
+    // the remainder below a microsecond carries over to the next delta, so replay does not drift
+    // a capped gap gets shorter on replay anyway
+    writer->last_ns = writer->count && delta_us < UINT32_MAX ? writer->last_ns + delta_us * 1000 : event->timestamp_ns;
+    writer->count++;
+}
+
+void input_trace_close(struct input_trace_writer *writer) {
+    if (writer->file) fclose(writer->file);
+    writer->file = NULL;
+}
+
+bool input_trace_load(struct input_trace *trace, const char *path) {
+    memset(trace, 0, sizeof(*trace));
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    char magic[8];
+    if (fread(magic, 8, 1, file) != 1 || memcmp(magic, INPUT_TRACE_MAGIC, 8) != 0) {
+        fprintf(stderr, "%s is not an input trace\n", path);
+        fclose(file);
+        return false;
+    }
+    uint32_t capacity = 0;
+    uint64_t timestamp = 0;
+    uint8_t record[RECORD_SIZE];
+    while (fread(record, RECORD_SIZE, 1, file) == 1) {
+        if (trace->count == capacity) {
+            capacity = capacity ? capacity * 2 : 1024;
+            struct app_event *events = realloc(trace->events, capacity * sizeof(*events));
+            if (!events) break;
+            trace->events = events;
+        }
+        timestamp += (uint64_t) get_u32(record + 1) * 1000;
+        trace->events[trace->count++] = (struct app_event){
+            .type = record[0],
+            .time = get_u32(record + 5),
+            .a = (int32_t) get_u32(record + 9),
+            .b = (int32_t) get_u32(record + 13),
+            .timestamp_ns = timestamp,
+        };
+    }
+    fclose(file);
+    return true;
+}
+
+void input_trace_free(struct input_trace *trace) {
+    free(trace->events);
+    memset(trace, 0, sizeof(*trace));
+}
@@ -0,0 +1,36 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "event_queue.h"
+
+// input events recorded with their timing, so a session can be replayed against any backend and build
+// file: "TEXTINP1", then one 17 byte little endian record per event:
+// u8 type, u32 microseconds since the previous event, u32 wayland time, i32 a, i32 b
+#define INPUT_TRACE_MAGIC "TEXTINP1"
+
+struct input_trace_writer {
+    FILE *file;
+    uint64_t last_ns;
+    uint32_t count;
+};
+
+struct input_trace {
+    struct app_event *events; // timestamp_ns relative to the first event
+    uint32_t count;
+};
+
+// only pointer and key events are recorded, the rest comes from the compositor of the replaying session
+bool input_trace_is_input(const struct app_event *event);
+
+bool input_trace_open(struct input_trace_writer *writer, const char *path);
+void input_trace_write(struct input_trace_writer *writer, const struct app_event *event);
+void input_trace_close(struct input_trace_writer *writer);
+
+bool input_trace_load(struct input_trace *trace, const char *path);
+void input_trace_free(struct input_trace *trace);
+
+#endif
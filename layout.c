@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "layout.h"
+#include "glyph.h"
+
+#define TAB_WIDTH 4
+
+static bool view_equal_but_cursor(const struct view *a, const struct view *b) {
+    return a->first_line == b->first_line && a->width == b->width && a->height == b->height &&
+           a->font_size == b->font_size && a->background == b->background && a->foreground == b->foreground;
+}
+
+static bool view_equal(const struct view *a, const struct view *b) {
+    return view_equal_but_cursor(a, b) && a->show_cursor == b->show_cursor && a->cursor_line == b->cursor_line &&
+           a->cursor_byte == b->cursor_byte;
+}
+
+// column the glyph starting at byte is shown in, tabs included
+static int line_column(const char *s, size_t length, size_t byte) {
+    int column = 0;
+    for (size_t i = 0; i < length && i < byte;) {
+        uint32_t codepoint;
+        i += utf8_decode(s + i, length - i, &codepoint);
+        column += codepoint == '\t' ? TAB_WIDTH - column % TAB_WIDTH : 1;
+    }
+    return column;
+}
+
+// one glyph run, and the cursor after it so it is drawn on top, returns the cursor's x or -1
+static int record_line(struct draw_list *list, const struct document *doc, const struct view *view, size_t line, int y) {
+    const int advance = glyph_advance(view->font_size);
+    const int margin = view->font_size / 2;
+    const char *s;
+    size_t length;
+    document_line(doc, line, &s, &length);
+    dl_glyphs_begin(list, margin, y, view->foreground);
+    int column = 0;
+    for (size_t i = 0; i < length && column * advance < view->width;) {
+        uint32_t codepoint;
+        i += utf8_decode(s + i, length - i, &codepoint);
+        if (codepoint == '\t') {
+            column += TAB_WIDTH - column % TAB_WIDTH;
+            continue;
+        }
+        // spaces take room but need no glyph
+        if (codepoint != ' ') dl_glyph(list, glyph_lookup(codepoint, view->font_size), column * advance);
+        column++;
+    }
+    if (!view->show_cursor || view->cursor_line != line) return -1;
+    const int x = margin + line_column(s, length, view->cursor_byte) * advance;
+    const int cursor_width = view->font_size / 8 > 1 ? view->font_size / 8 : 1;
+    dl_rect(list, x, y, cursor_width, glyph_line_height(view->font_size), view->foreground);
+    return x;
+}
+
+bool layout_update(struct layout *layout, const struct document *doc, const struct view *view) {
+    // cheap early out: same view of the same document needs no new list
+    if (layout->list.generation && layout->doc_generation == doc->generation &&
+        layout->doc_lines == doc->line_count && view_equal(&layout->view, view)) {
+        return false;
+    }
+    layout->view = *view;
+    layout->doc_generation = doc->generation;
+    layout->doc_lines = doc->line_count;
+
+    struct draw_list *list = &layout->list;
+    const int line_height = glyph_line_height(view->font_size);
+    const int margin = view->font_size / 2;
+    const size_t max_lines = view->height / line_height + 2;
+    if (max_lines > layout->line_capacity) {
+        uint32_t *offsets = realloc(layout->line_offsets, max_lines * sizeof(*offsets));
+        if (!offsets) {
+            fprintf(stderr, "Failed to grow line offsets to %zu lines\n", max_lines);
+            exit(1);
+        }
+        layout->line_offsets = offsets;
+        layout->line_capacity = max_lines;
+    }
+    dl_reset(list);
+    dl_rect(list, 0, 0, view->width, view->height, view->background);
+    dl_clip(list, margin, margin, view->width - 2 * margin, view->height - 2 * margin);
+    layout->visible_lines = 0;
+    layout->cursor_x = -1;
+    int y = margin;
+    for (size_t line = view->first_line; line < doc->line_count && y < view->height - margin; line++, y += line_height) {
+        layout->line_offsets[layout->visible_lines++] = dl_mark(list);
+        const int cursor_x = record_line(list, doc, view, line, y);
+        if (cursor_x >= 0) layout->cursor_x = cursor_x;
+    }
+    layout->line_offsets[layout->visible_lines] = dl_mark(list);
+    dl_clip(list, 0, 0, 0, 0);
+    layout->damage_x0 = 0;
+    layout->damage_y0 = 0;
+    layout->damage_x1 = view->width;
+    layout->damage_y1 = view->height;
+    // frame boundary for the glyph cache: this list is the only thing that refers to the new glyphs
+    glyph_commit();
+    return dl_finish(list);
+}
+
+bool layout_update_line(struct layout *layout, const struct document *doc, const struct view *view, size_t line,
+                        size_t edit_byte) {
+    const struct view *old = &layout->view;
+    if (!layout->list.generation || layout->doc_lines != doc->line_count || !view_equal_but_cursor(old, view) ||
+        line < view->first_line || line - view->first_line >= layout->visible_lines ||
+        (old->show_cursor && old->cursor_line != line) || (view->show_cursor && view->cursor_line != line)) {
+        return false;
+    }
+    const size_t index = line - view->first_line;
+    const int advance = glyph_advance(view->font_size);
+    const int line_height = glyph_line_height(view->font_size);
+    const int margin = view->font_size / 2;
+    const int y = margin + (int) index * line_height;
+    dl_reset(&layout->scratch);
+    const int cursor_x = record_line(&layout->scratch, doc, view, line, y);
+    dl_mark(&layout->scratch);
+    const uint32_t begin = layout->line_offsets[index], end = layout->line_offsets[index + 1];
+    dl_splice(&layout->list, begin, end, &layout->scratch);
+    const int64_t shift = (int64_t) layout->scratch.size - (end - begin);
+    for (size_t i = index + 1; i <= layout->visible_lines; i++) layout->line_offsets[i] += shift;
+
+    // everything right of the edit moves, a cursor move only changes the two cells it is in
+    int x0 = view->width, x1 = 0;
+    if (edit_byte != SIZE_MAX) {
+        const char *s;
+        size_t length;
+        document_line(doc, line, &s, &length);
+        x0 = margin + line_column(s, length, edit_byte) * advance;
+        x1 = view->width - margin;
+    }
+    const int cursors[2] = {layout->cursor_x, cursor_x};
+    for (int i = 0; i < 2; i++) {
+        if (cursors[i] < 0) continue;
+        if (cursors[i] < x0) x0 = cursors[i];
+        if (cursors[i] + advance > x1) x1 = cursors[i] + advance;
+    }
+    layout->damage_x0 = x0 > 0 ? x0 : 0;
+    layout->damage_y0 = y;
+    layout->damage_x1 = x1 < view->width ? x1 : view->width;
+    layout->damage_y1 = y + line_height < view->height ? y + line_height : view->height;
+    layout->cursor_x = cursor_x;
+    layout->view = *view;
+    layout->doc_generation = doc->generation;
+    glyph_commit();
+    dl_finish(&layout->list);
+    return true;
+}
+
+size_t layout_byte_at(const struct document *doc, const struct view *view, size_t line, int x) {
+    const int advance = glyph_advance(view->font_size);
+    const int margin = view->font_size / 2;
+    const char *s;
+    size_t length;
+    document_line(doc, line, &s, &length);
+    int column = 0;
+    for (size_t i = 0; i < length;) {
+        uint32_t codepoint;
+        const int n = utf8_decode(s + i, length - i, &codepoint);
+        const int next = codepoint == '\t' ? column + TAB_WIDTH - column % TAB_WIDTH : column + 1;
+        // past the middle of the cell the cursor goes behind it
+        if (x < margin + (column + next) * advance / 2) return i;
+        column = next;
+        i += n;
+    }
+    return length;
+}
+
+void layout_copy(struct layout *dst, const struct layout *src) {
+    if (src->line_capacity > dst->line_capacity) {
+        uint32_t *offsets = realloc(dst->line_offsets, src->line_capacity * sizeof(*offsets));
+        if (!offsets) {
+            fprintf(stderr, "Failed to grow line offsets to %zu lines\n", src->line_capacity);
+            exit(1);
+        }
+        dst->line_offsets = offsets;
+        dst->line_capacity = src->line_capacity;
+    }
+    if (src->line_capacity) memcpy(dst->line_offsets, src->line_offsets, (src->visible_lines + 1) * sizeof(uint32_t));
+    dl_copy(&dst->list, &src->list);
+    dst->view = src->view;
+    dst->doc_generation = src->doc_generation;
+    dst->doc_lines = src->doc_lines;
+    dst->visible_lines = src->visible_lines;
+    dst->cursor_x = src->cursor_x;
+    dst->damage_x0 = src->damage_x0;
+    dst->damage_y0 = src->damage_y0;
+    dst->damage_x1 = src->damage_x1;
+    dst->damage_y1 = src->damage_y1;
+}
+
+void layout_free(struct layout *layout) {
+    dl_free(&layout->list);
+    dl_free(&layout->scratch);
+    free(layout->line_offsets);
+    memset(layout, 0, sizeof(*layout));
+}
+
+size_t layout_scroll(size_t first_line, size_t line_count, int32_t value, int32_t *remainder) {
+    *remainder += value;
+    const int lines = *remainder / SCROLL_UNITS_PER_LINE;
+    *remainder -= lines * SCROLL_UNITS_PER_LINE;
+    if (line_count == 0 || (lines < 0 && (size_t) -lines > first_line)) return 0;
+    if (first_line + lines >= line_count) return line_count - 1;
+    return first_line + lines;
+}
+
+void layout_prewarm(const struct document *doc, const struct view *view, struct thread_pool *pool) {
+    const int advance = glyph_advance(view->font_size);
+    const int line_height = glyph_line_height(view->font_size);
+    const int margin = view->font_size / 2;
+    const int columns = view->width / advance + 1;
+    const int lines = view->height / line_height + 1;
+    // ascii first, then the first screen walked the same way layout_update walks it
+    const int capacity = 0x7F - 0x21 + columns * lines;
+    uint32_t *codepoints = malloc(capacity * sizeof(*codepoints));
+    if (!codepoints) return;
+    int count = 0;
+    for (uint32_t c = 0x21; c < 0x7F; c++) codepoints[count++] = c;
+    int y = margin;
+    for (size_t line = view->first_line; line < doc->line_count && y < view->height - margin; line++, y += line_height) {
+        const char *s;
+        size_t length;
+        document_line(doc, line, &s, &length);
+        int column = 0;
+        for (size_t i = 0; i < length && column * advance < view->width && count < capacity;) {
+            uint32_t codepoint;
+            i += utf8_decode(s + i, length - i, &codepoint);
+            if (codepoint == '\t') {
+                column += TAB_WIDTH - column % TAB_WIDTH;
+                continue;
+            }
+            // ascii is already in, so only the rest of the screen is added
+            if (codepoint > 0x7E) codepoints[count++] = codepoint;
+            column++;
+        }
+    }
+    glyph_prewarm(pool, codepoints, count, view->font_size);
+    free(codepoints);
+}
+
+void layout_warm_lines(const struct document *doc, const struct view *view, size_t first, size_t count) {
+    const int advance = glyph_advance(view->font_size);
+    for (size_t line = first; line < doc->line_count && line < first + count; line++) {
+        const char *s;
+        size_t length;
+        document_line(doc, line, &s, &length);
+        int column = 0;
+        for (size_t i = 0; i < length && column * advance < view->width;) {
+            uint32_t codepoint;
+            i += utf8_decode(s + i, length - i, &codepoint);
+            if (codepoint == '\t') {
+                column += TAB_WIDTH - column % TAB_WIDTH;
+                continue;
+            }
+            if (codepoint != ' ') glyph_lookup(codepoint, view->font_size);
+            column++;
+        }
+    }
+    glyph_commit();
+}
@@ -0,0 +1,55 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "draw_list.h"
+#include "text.h"
+
+struct view {
+    size_t first_line; // scroll position
+    int width, height;
+    int font_size;     // pixels
+    uint32_t background, foreground;
+    bool show_cursor;
+    size_t cursor_line, cursor_byte; // the text cursor is a bar in front of this byte
+};
+
+struct layout {
+    struct draw_list list;
+    struct view view;        // view the list was recorded for
+    uint32_t doc_generation; // document generation the list was recorded for
+    size_t doc_lines;
+    uint32_t *line_offsets;  // list position of every visible line, and of the end of the last one
+    size_t line_capacity, visible_lines;
+    int cursor_x;            // where the cursor was recorded, -1 if it is not visible
+    struct draw_list scratch; // the line recorded by layout_update_line
+    int damage_x0, damage_y0, damage_x1, damage_y1; // device pixels the last update changed
+};
+
+// records the visible part of doc into layout->list
+// returns false if nothing changed and the previous list (and whatever a backend drew from it) is still valid
+bool layout_update(struct layout *layout, const struct document *doc, const struct view *view);
+// re-records only line, after an edit at edit_byte (SIZE_MAX if only the cursor moved) that changed no other line
+// the damage covers the cells from the edit or cursor on, returns false if the change needs layout_update
+bool layout_update_line(struct layout *layout, const struct document *doc, const struct view *view, size_t line,
+                        size_t edit_byte);
+// byte of line in front of the cell nearest to device x, to place the cursor with the pointer
+size_t layout_byte_at(const struct document *doc, const struct view *view, size_t line, int x);
+// makes dst what src is, so the other frame of a pipeline can continue from the newest layout
+void layout_copy(struct layout *dst, const struct layout *src);
+void layout_free(struct layout *layout);
+
+// pointer axis units (wl_fixed_t) per line scrolled
+#define SCROLL_UNITS_PER_LINE (10 * 256)
+// applies an axis value to first_line, remainder keeps the fraction so slow touchpad scrolling adds up
+size_t layout_scroll(size_t first_line, size_t line_count, int32_t value, int32_t *remainder);
+
+struct thread_pool;
+
+// rasterizes the glyphs of printable ascii and of everything visible in view up front, in parallel
+// anything that scrolls into view later is still rasterized lazily by layout_update
+void layout_prewarm(const struct document *doc, const struct view *view, struct thread_pool *pool);
+// looks up the glyphs of lines [first, first + count) as view would show them, without recording anything
+// meant for idle time, so scrolling finds the glyphs (and the document pages) already warm
+void layout_warm_lines(const struct document *doc, const struct view *view, size_t first, size_t count);
+
+#endif
@@ -8,77 +8,533 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <stdatomic.h>
+#include <limits.h>
 #include <linux/input-event-codes.h>
+#include <xkbcommon/xkbcommon.h>
 
 #include "xdg-shell-client-protocol.h"
 #include "viewporter-client-protocol.h"
+#include "fractional-scale-v1-client-protocol.h"
+#include "helper/util.h"
+#include "layout.h"
+#include "cpu_draw.h"
+#include "event_queue.h"
+#include "glyph.h"
+#include "idle.h"
+#include "uring_loader.h"
+#include "trace.h"
+#include "hud.h"
+#include "input_trace.h"
+#include "protocol_stats.h"
+#include "arena.h"
+#include "shm_memory.h"
+#include "event_loop.h"
 
 static struct wl_display *display;
 static struct wl_compositor *compositor;
 static struct wl_surface *surface;
 static struct wl_shm *shm;
-static struct wl_buffer *buffer;
 static struct xdg_wm_base *xdg_wm_base;
 static struct xdg_surface *xdg_surface;
 static struct xdg_toplevel *xdg_toplevel;
 static struct wp_viewporter *viewporter;
 static struct wp_viewport *viewport;
+static struct wp_fractional_scale_manager_v1 *fractional_scale_manager;
 static struct wl_seat *seat;
+static struct wl_subcompositor *subcompositor;
 struct wl_pointer *pointer;
+struct wl_keyboard *keyboard;
+// keymap and modifier state, dispatch thread only: the render thread gets keysyms and characters
+static struct xkb_context *xkb_context;
+static struct xkb_keymap *xkb_keymap;
+static struct xkb_state *xkb_state;
 
-static volatile uint32_t *frame_buffer;
-static int width = 100;
-static int height = 100;
-static bool running = true;
-static bool configured = false;
+// dispatch thread: one epoll loop over the wayland fd, the timers below, input replay and signals
+static struct event_loop loop;
+static bool wayland_readable = false; // set by the loop, the read itself happens after wl_display_prepare_read
+static int repeat_timer = -1, blink_timer = -1, replay_timer = -1;
+static int32_t repeat_rate = 25, repeat_delay = 600; // keys per second and ms before the first, from repeat_info
+static xkb_keycode_t repeat_keycode = 0;             // key held down and repeated, 0 if none
+#define BLINK_INTERVAL_NS 530000000ull
+#define BLINK_TIMEOUT_NS 10000000000ull // blinking stops, cursor shown, this long after the last key, so idle means asleep
+static bool blink_on = true;
+static uint64_t last_key_ns = 0;
+static const char *trace_path; // TEXT_TRACE
 
-// todo: maybe move to helper/util.h
-static uint64_t get_time_ns(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
-    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+static int width = 800;  // render thread only after startup: size of the next frame, set by configure
+static int height = 600; // in surface coordinates, buffers are scale times larger
+static int scale120 = 120; // render thread only: device pixels per surface pixel, in 120ths like wp_fractional_scale_v1
+static atomic_bool running = true;
+static bool configured = false; // render thread only
+static int pending_width = 0, pending_height = 0; // render thread only: toplevel size of the configure in progress
+
+// listeners only translate wayland events into app events, the render thread does the rest
+static struct event_queue events;
+static thrd_t render_thread;
+static bool frame_pending = false; // render thread only: a commit is waiting for its frame callback
+static bool needs_redraw = false;  // render thread only: the view changed since the last layout
+static size_t first_line = 0;      // render thread only: scroll position
+static int32_t scroll_remainder = 0;
+static size_t cursor_line = 0, cursor_byte = 0; // render thread only: the text cursor
+static bool cursor_visible = true;              // render thread only: blink phase, owned by the dispatch thread
+static int32_t pointer_x = 0, pointer_y = 0;   // render thread only: last pointer position in wl_fixed_t
+// render thread only: a change confined to one line since the last layout, laid out by layout_update_line
+// unless needs_redraw asks for a full layout anyway
+static size_t dirty_line = SIZE_MAX;
+static size_t dirty_byte = SIZE_MAX; // first byte of the line that changed, SIZE_MAX if only the cursor moved
+
+static struct document document;
+static struct thread_pool pool;
+static struct cpu_tiler tiler;
+
+// frame pipeline, render thread only: while frame N is rasterized on the pool or waits for the compositor,
+// frame N + 1 is already laid out, so a frame costs about its slowest stage instead of the sum of them
+// frames carry a generation so a finished frame is never shown after a newer one
+#define BUFFER_COUNT 3 // one held by the compositor, one ready to commit, one being rasterized
+
+struct damage_rect {
+    int x0, y0, x1, y1; // device pixels
+};
+
+struct shm_buffer {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    int width, height;
+    int surface_width, surface_height; // of the frame in it
+    uint32_t generation; // of the frame in it, 0 if its content is undefined
+    bool busy; // attached and not released by the compositor yet
+    // frame buffers only: every one has its own memory, so one can grow while the compositor holds another
+    struct shm_memory memory;
+    struct wl_shm_pool *pool;
+};
+
+struct frame {
+    uint32_t generation; // bumped for every layout that changed what is on screen
+    struct layout layout; // in device pixels
+    int surface_width, surface_height; // what the viewport scales it to
+    int buffer;          // shm buffer it is rasterized into
+    struct damage_rect raster; // what is redrawn, the buffer holds an older frame everywhere else
+};
+
+static struct shm_buffer buffers[BUFFER_COUNT];
+static struct frame frames[2];      // the one on the pool and the one being laid out
+static int laid_out = -1;           // frame waiting for a buffer to rasterize into
+static int latest_layout = -1;      // frame holding the newest layout, the one a single line update continues from
+static int rasterizing = -1;        // frame on the pool
+static struct task_group raster_group;
+static int ready_buffer = -1;       // rasterized, waiting for the compositor to want a frame
+static uint32_t ready_generation = 0;
+static uint32_t shown_generation = 0;
+static uint32_t next_generation = 0;
+static uint64_t last_hash = 0;      // content of the newest frame that was laid out
+static uint64_t last_commit_ns = 0;
+static int viewport_width = 0, viewport_height = 0; // destination set on the surface
+static uint64_t committed_frames = 0;
+#define STEADY_STATE_FRAMES 60      // commits before the arena guard is armed, startup allocates on purpose
+static uint32_t compositor_version = 1;
+
+// what every generation changed compared to the one before, so a buffer that holds a recent frame
+// and the compositor's copy of the surface are only brought up to date where it matters
+#define DAMAGE_HISTORY 8
+static struct damage_rect damage_history[DAMAGE_HISTORY];
+
+// statistics overlay in its own desynchronized subsurface, toggled with the right mouse button or TEXT_HUD=1
+#define HUD_INTERVAL_NS 250000000ull // text that changes every frame is unreadable
+static struct wl_surface *hud_surface;
+static struct wl_subsurface *hud_subsurface;
+static struct shm_buffer hud_buffers[2]; // release events carry BUFFER_COUNT + index
+static struct hud hud;
+static bool hud_visible = false;
+static uint64_t hud_updated_ns = 0;
+
+static int to_device(int surface_pixels) {
+    return (surface_pixels * scale120 + 60) / 120;
+}
+
+// in device pixels: glyphs are rasterized at the size they are shown, the viewport maps the buffer back to the surface
+static struct view current_view(void) {
+    return (struct view){.first_line = first_line, .width = to_device(width), .height = to_device(height),
+                         .font_size = to_device(8), .background = 0xFF1E1E1E, .foreground = 0xFFD4D4D4,
+                         .show_cursor = cursor_visible, .cursor_line = cursor_line, .cursor_byte = cursor_byte};
+}
+
+// union of the damage of generations (since, generation], false if the history does not reach back that far
+static bool damage_since(uint32_t since, uint32_t generation, struct damage_rect *out) {
+    if (!since || generation - since > DAMAGE_HISTORY) return false;
+    *out = (struct damage_rect){INT_MAX, INT_MAX, 0, 0};
+    for (uint32_t g = since + 1; g <= generation; g++) {
+        const struct damage_rect *d = &damage_history[g % DAMAGE_HISTORY];
+        if (d->x0 < out->x0) out->x0 = d->x0;
+        if (d->y0 < out->y0) out->y0 = d->y0;
+        if (d->x1 > out->x1) out->x1 = d->x1;
+        if (d->y1 > out->y1) out->y1 = d->y1;
+    }
+    return true;
+}
+
+// idle work, render thread only, see render_main
+#define IDLE_INDEX_BYTES (1 << 20) // a fraction of a millisecond of memchr
+#define IDLE_WARM_LINES 16
+static struct idle_scheduler idle;
+static size_t warm_first_line = SIZE_MAX; // view the glyph warming works around
+static size_t warm_done = 0;              // lines warmed around it so far
+
+static size_t screen_lines(const struct view *view) {
+    return view->height / glyph_line_height(view->font_size) + 1;
+}
+
+static struct uring_loader loader;
+static bool loading = false; // document is still coming in through the loader
+static int loader_fd = -1;    // eventfd the loader's ring signals when reads complete, watched by the dispatch thread
+static const char *document_path;
+
+// the loader gave up partway through the file, loads it again the plain way
+// edits can only touch lines that had arrived, so they carry over to the reloaded document
+static void reload_document(void) {
+    uring_loader_close(&loader);
+    loading = false;
+    struct document loaded;
+    if (!document_load(&loaded, document_path)) return; // keeps what did arrive
+    document_index_lines(&loaded, document.indexed > IDLE_INDEX_BYTES ? document.indexed : IDLE_INDEX_BYTES);
+    loaded.edits = document.edits;
+    loaded.edit_count = document.edit_count;
+    loaded.edit_capacity = document.edit_capacity;
+    loaded.generation = document.generation + 1;
+    document.edits = NULL;
+    document.edit_count = document.edit_capacity = 0;
+    document_free(&document);
+    document = loaded;
+    needs_redraw = true;
+}
+
+// idle task: extends the line index, startup only indexes the first chunk
+// with the io_uring loader it reaps reads instead, indexing what arrived
+static bool idle_index_lines(void *arg) {
+    const size_t lines = document.line_count;
+    bool done;
+    bool waiting = false;
+    if (loading) {
+        const size_t indexed = document.indexed;
+        done = uring_loader_poll(&loader, &document, false);
+        if (loader.failed) {
+            reload_document();
+            done = false; // document_index_lines takes over from here
+        } else if (done) {
+            uring_loader_close(&loader);
+            loading = false;
+        } else if (document.indexed == indexed) {
+            waiting = true; // reads still in flight, APP_EVENT_LOADER_READY wakes the task once some complete
+        }
+    } else {
+        done = document_index_lines(&document, IDLE_INDEX_BYTES);
+    }
+    // the view ran into the end of the index, show what it can now
+    const struct view view = current_view();
+    if (document.line_count != lines && first_line + screen_lines(&view) >= lines) needs_redraw = true;
+    return !done && !waiting;
+}
+
+// idle task: warms the glyphs of one screen below the view, then one above, a few lines per slice
+static bool idle_warm_glyphs(void *arg) {
+    const struct view view = current_view();
+    const size_t screen = screen_lines(&view);
+    if (warm_first_line != first_line) {
+        warm_first_line = first_line;
+        warm_done = 0;
+    }
+    size_t start, end;
+    if (warm_done < screen) {
+        start = first_line + screen + warm_done;
+        end = first_line + 2 * screen;
+    } else {
+        start = (first_line > screen ? first_line - screen : 0) + warm_done - screen;
+        end = first_line;
+    }
+    if (start >= end || start >= document.line_count) {
+        // below is done or past the end, go on with above
+        if (warm_done < screen) {
+            warm_done = screen;
+            return true;
+        }
+        return false;
+    }
+    const size_t count = end - start < IDLE_WARM_LINES ? end - start : IDLE_WARM_LINES;
+    layout_warm_lines(&document, &view, start, count);
+    warm_done += count;
+    return true;
+}
+
+static bool idle_interrupted(void *arg) {
+    return !event_queue_empty(&events);
+}
+
+// input recording and replay, dispatch thread only
+// TEXT_RECORD=input.trace records the session, TEXT_REPLAY=input.trace [TEXT_REPLAY_SPEED=4] plays one back and exits
+static struct input_trace_writer recorder;
+static struct input_trace replay;
+static uint32_t replay_next = 0;
+static uint64_t replay_start_ns = 0;
+static uint64_t replay_end_ns = 0;
+static double replay_speed = 1.0;
+
+// runs on the dispatch thread, must not block
+static void push_event(struct app_event event) {
+    event.timestamp_ns = get_time_ns();
+    input_trace_write(&recorder, &event);
+    event_queue_push(&events, &event);
+}
+
+static uint64_t replay_due_ns(void) {
+    return replay_start_ns + (uint64_t) (replay.events[replay_next].timestamp_ns / replay_speed);
 }
 
-static inline void draw_to_buffer(uint32_t color) {
-    // draw to the buffer, a simple loop to simulate some drawing logic, needs not be optimal
-    for (int i = 0; i < width * height; i++) {
-        frame_buffer[i] = color;
+// pushes the replayed events that are due and sets the replay timer to the next one
+// a second after the last event, so its frames make it to the screen, the app exits
+static void replay_events(void *arg, uint32_t ready) {
+    event_loop_timer_read(replay_timer);
+    const uint64_t now = get_time_ns();
+    while (replay_next < replay.count && replay_due_ns() <= now) {
+        struct app_event event = replay.events[replay_next++];
+        event.timestamp_ns = now;
+        event_queue_push(&events, &event);
     }
+    uint64_t due;
+    if (replay_next < replay.count) {
+        due = replay_due_ns();
+    } else {
+        if (!replay_end_ns) {
+            printf("Replayed %u events in %lu ms\n", replay.count, (unsigned long) ((now - replay_start_ns) / 1000000));
+            replay_end_ns = now + 1000000000;
+        }
+        if (now >= replay_end_ns) running = false;
+        due = replay_end_ns;
+    }
+    // 0 would disarm, 1 ns fires right away
+    event_loop_timer_set(replay_timer, due > now ? due - now : 1, 0);
 }
 
 // frame callback to measure timing of frame
 static void frame_callback(void *data, struct wl_callback *callback, uint32_t presentation_time) {
+    const uint64_t zone = trace_begin();
     const uint64_t submit_time = (uintptr_t) data;
     const uint64_t finish_time = get_time_ns();
     printf("Input-to-display latency: %lu microseconds\n", (finish_time - submit_time) / 1000);
     wl_callback_destroy(callback);
+    push_event((struct app_event){.type = APP_EVENT_FRAME_DONE});
+    trace_end("frame callback", zone);
 }
 static const struct wl_callback_listener frame_listener = {
     .done = frame_callback,
 };
 
-static void draw_new_buffer(void)
-{
-    // draw into frame buffer + measure timing
-    uint64_t start_time = get_time_ns();
-    draw_to_buffer(0xFF000000 | time(NULL) * 1000);
-    wl_surface_damage(surface, 0, 0, width, height);
-    uint64_t finish_time = get_time_ns();
-    // printf("Input-to-buffer latency: %lu microseconds\n", (finish_time - start_time) / 1000);
+static void buffer_release(void *data, struct wl_buffer *buffer) {
+    push_event((struct app_event){.type = APP_EVENT_BUFFER_RELEASE, .a = (int) (intptr_t) data});
+}
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+// pool task: stage 2, wakes the render thread when done
+static void raster_frame(void *arg) {
+    const uint64_t zone = trace_begin();
+    arena_guard_begin();
+    const struct frame *frame = arg;
+    const struct shm_buffer *buffer = &buffers[frame->buffer];
+    const struct cpu_target target = {buffer->pixels, buffer->width, buffer->height, buffer->width};
+    const struct damage_rect *r = &frame->raster;
+    // a typed character redraws a few cells of one line, not worth waking the workers for
+    if ((int64_t) (r->x1 - r->x0) * (r->y1 - r->y0) * 4 < (int64_t) buffer->width * buffer->height) {
+        cpu_draw_region(&frame->layout.list, &target, r->x0, r->y0, r->x1, r->y1);
+    } else {
+        cpu_draw_list_parallel(&tiler, &pool, &frame->layout.list, &target);
+    }
+    arena_guard_end();
+    trace_end("raster", zone);
+    event_queue_notify(&events);
+}
+
+static int free_buffer(void) {
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        if (!buffers[i].busy && i != ready_buffer && !(rasterizing >= 0 && frames[rasterizing].buffer == i)) return i;
+    }
+    return -1;
+}
 
+// gives a free buffer the size of the frame about to be rasterized into it
+// memory grows geometrically and is kept when shrinking, so a resize drag only recreates the wl_buffer
+static bool fit_buffer(int index, int w, int h) {
+    struct shm_buffer *buffer = &buffers[index];
+    if (buffer->buffer && buffer->width == w && buffer->height == h) return true;
+    const size_t size = (size_t) w * h * 4;
+    if (size > buffer->memory.size) {
+        if (!shm_memory_grow(&buffer->memory, size)) {
+            // usually the reserved huge pages ran out, the frame moves to memory of the next smaller kind
+            const enum shm_pages pages =
+                buffer->memory.pages == SHM_PAGES_HUGETLB ? SHM_PAGES_TRANSPARENT : SHM_PAGES_SMALL;
+            struct shm_memory memory;
+            if (!shm_memory_create(&memory, "buffer", size, pages)) {
+                fprintf(stderr, "Failed to grow frame buffer memory to %zu bytes\n", size);
+                return false;
+            }
+            printf("Frame buffer %d moved to %s pages\n", index, shm_pages_name(memory.pages));
+            shm_memory_destroy(&buffer->memory);
+            buffer->memory = memory;
+            PROTOCOL_REQUEST(wl_shm_pool_destroy(buffer->pool));
+            buffer->pool = PROTOCOL_REQUEST(wl_shm_create_pool(shm, buffer->memory.fd, buffer->memory.size));
+        } else if (buffer->memory.pages == SHM_PAGES_HUGETLB) {
+            // compositors mremap on a pool resize, which older kernels refuse for hugetlb, a new pool maps it fresh
+            PROTOCOL_REQUEST(wl_shm_pool_destroy(buffer->pool));
+            buffer->pool = PROTOCOL_REQUEST(wl_shm_create_pool(shm, buffer->memory.fd, buffer->memory.size));
+        } else {
+            PROTOCOL_REQUEST(wl_shm_pool_resize(buffer->pool, buffer->memory.size));
+        }
+    }
+    if (buffer->buffer) PROTOCOL_REQUEST(wl_buffer_destroy(buffer->buffer));
+    buffer->buffer = PROTOCOL_REQUEST(wl_shm_pool_create_buffer(buffer->pool, 0, w, h, w * 4, WL_SHM_FORMAT_ARGB8888));
+    wl_buffer_add_listener(buffer->buffer, &buffer_listener, (void *) (intptr_t) index);
+    buffer->pixels = (uint32_t *) buffer->memory.data;
+    buffer->width = w;
+    buffer->height = h;
+    buffer->generation = 0;
+    return true;
+}
+
+static void commit_frame(void) {
+    const uint64_t zone = trace_begin();
+    struct shm_buffer *shm_buffer = &buffers[ready_buffer];
+    const bool viewport_changed =
+        viewport && (shm_buffer->surface_width != viewport_width || shm_buffer->surface_height != viewport_height);
+    if (viewport_changed) {
+        viewport_width = shm_buffer->surface_width;
+        viewport_height = shm_buffer->surface_height;
+        PROTOCOL_REQUEST(wp_viewport_set_destination(viewport, viewport_width, viewport_height));
+    }
+    PROTOCOL_REQUEST(wl_surface_attach(surface, shm_buffer->buffer, 0, 0));
+    // buffer damage since version 4, older compositors get the whole surface
+    struct damage_rect damage;
+    uint64_t damaged_pixels = (uint64_t) shm_buffer->width * shm_buffer->height;
+    if (compositor_version >= 4 && !viewport_changed && damage_since(shown_generation, ready_generation, &damage)) {
+        PROTOCOL_REQUEST(wl_surface_damage_buffer(surface, damage.x0, damage.y0, damage.x1 - damage.x0, damage.y1 - damage.y0));
+        damaged_pixels = (uint64_t) (damage.x1 - damage.x0) * (damage.y1 - damage.y0);
+    } else {
+        PROTOCOL_REQUEST(wl_surface_damage(surface, 0, 0, shm_buffer->surface_width, shm_buffer->surface_height));
+    }
     // commit changes + add callback to measure timing
-    struct wl_callback *callback = wl_surface_frame(surface);
-    wl_callback_add_listener(callback, &frame_listener, (void *) finish_time);
-    wl_surface_commit(surface);
-    wl_display_flush(display);
+    struct wl_callback *callback = PROTOCOL_REQUEST(wl_surface_frame(surface));
+    wl_callback_add_listener(callback, &frame_listener, (void *) get_time_ns());
+    PROTOCOL_REQUEST(wl_surface_commit(surface));
+    protocol_flush(display);
+    protocol_frame_end(stdout);
+    if (++committed_frames == STEADY_STATE_FRAMES) arena_guard_arm(true);
+    shm_buffer->busy = true;
+    last_commit_ns = get_time_ns();
+    hud_damage(&hud, damaged_pixels);
+    shown_generation = ready_generation;
+    ready_buffer = -1;
+    frame_pending = true;
+    trace_end("commit", zone);
+}
+
+// redraws the overlay on the cpu and commits only its own surface
+static void update_hud(void) {
+    struct shm_buffer *hud_buffer = !hud_buffers[0].busy ? &hud_buffers[0] : !hud_buffers[1].busy ? &hud_buffers[1] : NULL;
+    if (!hud_surface || !hud_buffer) return;
+    hud_updated_ns = get_time_ns();
+    if (!hud_update(&hud)) return;
+    const struct cpu_target target = {hud_buffer->pixels, HUD_WIDTH, HUD_HEIGHT, HUD_WIDTH};
+    cpu_draw_list(&hud.list, &target);
+    PROTOCOL_REQUEST(wl_surface_attach(hud_surface, hud_buffer->buffer, 0, 0));
+    PROTOCOL_REQUEST(wl_surface_damage(hud_surface, 0, 0, HUD_WIDTH, HUD_HEIGHT));
+    PROTOCOL_REQUEST(wl_surface_commit(hud_surface));
+    protocol_flush(display);
+    hud_buffer->busy = true;
+}
+
+static void toggle_hud(void) {
+    if (!hud_surface) return;
+    hud_visible = !hud_visible;
+    if (hud_visible) {
+        update_hud();
+    } else {
+        // no buffer unmaps the subsurface
+        PROTOCOL_REQUEST(wl_surface_attach(hud_surface, NULL, 0, 0));
+        PROTOCOL_REQUEST(wl_surface_commit(hud_surface));
+        protocol_flush(display);
+    }
+}
+
+// advances every stage that can make progress, called whenever the render thread wakes up
+static void pump_frames(void) {
+    // stage 2 finished: the frame replaces any older one that never made it to the screen
+    if (rasterizing >= 0 && atomic_load(&raster_group.pending) == 0) {
+        ready_buffer = frames[rasterizing].buffer;
+        ready_generation = frames[rasterizing].generation;
+        rasterizing = -1;
+    }
+    // stage 1: lay out the newest state, into the frame that is not on the pool
+    // a change to one line continues from the newest layout and only re-records that line
+    if (needs_redraw || dirty_line != SIZE_MAX) {
+        const int slot = rasterizing == 0 ? 1 : 0;
+        const struct view view = current_view();
+        struct layout *layout = &frames[slot].layout;
+        const uint64_t zone = trace_begin();
+        arena_guard_begin();
+        bool line_only = false;
+        if (!needs_redraw && latest_layout >= 0) {
+            if (latest_layout != slot) layout_copy(layout, &frames[latest_layout].layout);
+            line_only = layout_update_line(layout, &document, &view, dirty_line, dirty_byte);
+        }
+        if (!line_only) layout_update(layout, &document, &view);
+        arena_guard_end();
+        trace_end(line_only ? "layout line" : "layout", zone);
+        needs_redraw = false;
+        dirty_line = dirty_byte = SIZE_MAX;
+        latest_layout = slot;
+        if (!next_generation || layout->list.hash != last_hash) {
+            last_hash = layout->list.hash;
+            frames[slot].generation = ++next_generation;
+            frames[slot].surface_width = width;
+            frames[slot].surface_height = height;
+            damage_history[next_generation % DAMAGE_HISTORY] = line_only
+                ? (struct damage_rect){layout->damage_x0, layout->damage_y0, layout->damage_x1, layout->damage_y1}
+                : (struct damage_rect){0, 0, view.width, view.height};
+            laid_out = slot;
+        }
+    }
+    // stage 2: rasterize into a buffer the compositor does not hold
+    if (laid_out >= 0 && rasterizing < 0) {
+        const int buffer = free_buffer();
+        const struct view *view = &frames[laid_out].layout.view;
+        if (buffer >= 0 && fit_buffer(buffer, view->width, view->height)) {
+            struct frame *frame = &frames[laid_out];
+            if (!damage_since(buffers[buffer].generation, frame->generation, &frame->raster)) {
+                frame->raster = (struct damage_rect){0, 0, view->width, view->height};
+            }
+            buffers[buffer].generation = frame->generation;
+            buffers[buffer].surface_width = frames[laid_out].surface_width;
+            buffers[buffer].surface_height = frames[laid_out].surface_height;
+            frames[laid_out].buffer = buffer;
+            rasterizing = laid_out;
+            laid_out = -1;
+            task_group_run(&pool, &raster_group, raster_frame, &frames[rasterizing]);
+        }
+    }
+    // stage 3: show the newest finished frame once the compositor wants one
+    if (ready_buffer >= 0 && configured && !frame_pending) {
+        if (ready_generation > shown_generation) commit_frame();
+        else ready_buffer = -1;
+    }
 }
 
 static void xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
                                    int32_t w, int32_t h, struct wl_array *states)
 {
-    if (w > 0 && h > 0 && viewport) {
-        wp_viewport_set_destination(viewport, w, h);
-    }
+    push_event((struct app_event){.type = APP_EVENT_TOPLEVEL_SIZE, .a = w, .b = h});
 }
 
 static void pointer_enter(void *data, struct wl_pointer *pointer,
@@ -95,24 +551,23 @@ static void pointer_leave(void *data, struct wl_pointer *pointer,
 static void pointer_motion(void *data, struct wl_pointer *pointer,
                            uint32_t time, wl_fixed_t sx, wl_fixed_t sy) {
     // Mouse movement
-    draw_new_buffer();
+    push_event((struct app_event){.type = APP_EVENT_POINTER_MOTION, .time = time, .a = sx, .b = sy});
 }
 
 static void pointer_button(void *data, struct wl_pointer *pointer, uint32_t serial,
                            uint32_t time, uint32_t button, uint32_t state) {
-    if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
-        draw_new_buffer();
-    }
+    push_event((struct app_event){.type = APP_EVENT_POINTER_BUTTON, .time = time, .serial = serial,
+                                  .a = button, .b = state});
 }
 
 /* // - dragging and resizing the window;
 static void pointer_button(void *data, struct wl_pointer *pointer, uint32_t serial,
                          uint32_t time, uint32_t button, uint32_t state) {
     if (button == BTN_LEFT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
-        xdg_toplevel_move(xdg_toplevel, seat, serial);
+        PROTOCOL_REQUEST(xdg_toplevel_move(xdg_toplevel, seat, serial));
     }
     else if (button == BTN_RIGHT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
-        xdg_toplevel_resize(xdg_toplevel, seat, serial, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT);
+        PROTOCOL_REQUEST(xdg_toplevel_resize(xdg_toplevel, seat, serial, XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT));
     }
 }
 */
@@ -120,6 +575,7 @@ static void pointer_button(void *data, struct wl_pointer *pointer, uint32_t seri
 static void pointer_axis(void *data, struct wl_pointer *pointer,
                         uint32_t time, uint32_t axis, wl_fixed_t value) {
     // Scroll wheel
+    push_event((struct app_event){.type = APP_EVENT_POINTER_AXIS, .time = time, .a = axis, .b = value});
 }
 
 static const struct wl_pointer_listener pointer_listener = {
@@ -130,12 +586,135 @@ static const struct wl_pointer_listener pointer_listener = {
     .axis = pointer_axis,
 };
 
+static void keyboard_keymap(void *data, struct wl_keyboard *keyboard, uint32_t format, int32_t fd, uint32_t size) {
+    if (format != WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1) {
+        close(fd);
+        return;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return;
+    struct xkb_keymap *keymap = xkb_keymap_new_from_string(xkb_context, map, XKB_KEYMAP_FORMAT_TEXT_V1,
+                                                           XKB_KEYMAP_COMPILE_NO_FLAGS);
+    munmap(map, size);
+    if (!keymap) {
+        fprintf(stderr, "Failed to compile the keymap\n");
+        return;
+    }
+    xkb_state_unref(xkb_state);
+    xkb_keymap_unref(xkb_keymap);
+    xkb_keymap = keymap;
+    xkb_state = xkb_state_new(keymap);
+}
+
+static void set_blink(bool on) {
+    if (blink_on == on) return;
+    blink_on = on;
+    push_event((struct app_event){.type = APP_EVENT_CURSOR_BLINK, .a = on});
+}
+
+// typing shows the cursor and starts the blink over
+static void restart_blink(void) {
+    last_key_ns = get_time_ns();
+    set_blink(true);
+    event_loop_timer_set(blink_timer, BLINK_INTERVAL_NS, BLINK_INTERVAL_NS);
+}
+
+// loop callback: one blink per wakeup, however many intervals passed while the thread was busy
+static void blink(void *arg, uint32_t ready) {
+    if (!event_loop_timer_read(blink_timer)) return;
+    if (blink_on && get_time_ns() - last_key_ns > BLINK_TIMEOUT_NS) {
+        event_loop_timer_set(blink_timer, 0, 0);
+        return;
+    }
+    set_blink(!blink_on);
+}
+
+// the loader's eventfd: reads completed, the render thread reaps them in its idle time
+static void loader_ready(void *arg, uint32_t ready) {
+    uint64_t count;
+    if (read(loader_fd, &count, sizeof(count)) != sizeof(count)) return;
+    push_event((struct app_event){.type = APP_EVENT_LOADER_READY});
+}
+
+static void push_key(xkb_keycode_t keycode, uint32_t time, uint32_t serial) {
+    push_event((struct app_event){.type = APP_EVENT_KEY, .time = time, .serial = serial,
+                                  .a = xkb_state_key_get_one_sym(xkb_state, keycode),
+                                  .b = xkb_state_key_get_utf32(xkb_state, keycode)});
+}
+
+static void stop_repeat(void) {
+    repeat_keycode = 0;
+    event_loop_timer_set(repeat_timer, 0, 0);
+}
+
+// loop callback: one key per wakeup, a stalled thread does not catch up with a burst of repeats
+static void repeat_key(void *arg, uint32_t ready) {
+    if (!event_loop_timer_read(repeat_timer) || !repeat_keycode || !xkb_state) return;
+    push_key(repeat_keycode, get_time_ns() / 1000000, 0);
+    restart_blink();
+}
+
+static void keyboard_enter(void *data, struct wl_keyboard *keyboard, uint32_t serial, struct wl_surface *surface,
+                           struct wl_array *keys) {
+    restart_blink();
+}
+
+static void keyboard_leave(void *data, struct wl_keyboard *keyboard, uint32_t serial, struct wl_surface *surface) {
+    // no focus, no cursor
+    stop_repeat();
+    event_loop_timer_set(blink_timer, 0, 0);
+    set_blink(false);
+}
+
+static void keyboard_key(void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t time, uint32_t key,
+                         uint32_t state) {
+    if (!xkb_state) return;
+    const xkb_keycode_t keycode = key + 8; // evdev to xkb
+    if (state != WL_KEYBOARD_KEY_STATE_PRESSED) {
+        if (keycode == repeat_keycode) stop_repeat();
+        return;
+    }
+    push_key(keycode, time, serial);
+    restart_blink();
+    if (repeat_rate > 0 && xkb_keymap_key_repeats(xkb_keymap, keycode)) {
+        repeat_keycode = keycode;
+        event_loop_timer_set(repeat_timer, (uint64_t) repeat_delay * 1000000, 1000000000ull / repeat_rate);
+    } else if (repeat_keycode) {
+        stop_repeat();
+    }
+}
+
+static void keyboard_modifiers(void *data, struct wl_keyboard *keyboard, uint32_t serial, uint32_t depressed,
+                               uint32_t latched, uint32_t locked, uint32_t group) {
+    if (xkb_state) xkb_state_update_mask(xkb_state, depressed, latched, locked, 0, 0, group);
+}
+
+static void keyboard_repeat_info(void *data, struct wl_keyboard *keyboard, int32_t rate, int32_t delay) {
+    repeat_rate = rate;
+    repeat_delay = delay > 0 ? delay : 1;
+    if (rate <= 0) stop_repeat();
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+    .keymap = keyboard_keymap,
+    .enter = keyboard_enter,
+    .leave = keyboard_leave,
+    .key = keyboard_key,
+    .modifiers = keyboard_modifiers,
+    .repeat_info = keyboard_repeat_info,
+};
+
 static void seat_capabilities(void *data, struct wl_seat *wl_seat,
                             uint32_t capabilities) {
-    if (capabilities & WL_SEAT_CAPABILITY_POINTER) {
+    if ((capabilities & WL_SEAT_CAPABILITY_POINTER) && !pointer) {
         pointer = wl_seat_get_pointer(wl_seat);
         wl_pointer_add_listener(pointer, &pointer_listener, NULL);
     }
+    if ((capabilities & WL_SEAT_CAPABILITY_KEYBOARD) && !keyboard) {
+        keyboard = wl_seat_get_keyboard(wl_seat);
+        wl_keyboard_add_listener(keyboard, &keyboard_listener, NULL);
+    }
 }
 
 static const struct wl_seat_listener seat_listener = {
@@ -144,6 +723,7 @@ static const struct wl_seat_listener seat_listener = {
 
 static void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
     running = false;
+    push_event((struct app_event){.type = APP_EVENT_CLOSE});
 }
 static const struct xdg_toplevel_listener toplevel_listener = {
     .configure = xdg_toplevel_configure,
@@ -152,7 +732,7 @@ static const struct xdg_toplevel_listener toplevel_listener = {
 
 static void xdg_wm_base_ping(void *data, struct xdg_wm_base *shell, uint32_t serial)
 {
-    xdg_wm_base_pong(shell, serial);
+    PROTOCOL_REQUEST(xdg_wm_base_pong(shell, serial));
 }
 static const struct xdg_wm_base_listener shell_listener = {
     .ping = xdg_wm_base_ping,
@@ -160,28 +740,271 @@ static const struct xdg_wm_base_listener shell_listener = {
 
 static void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial)
 {
-    xdg_surface_ack_configure(xdg_surface, serial);
-    if (!configured) {
-        wl_surface_attach(surface, buffer, 0, 0);
-        wl_surface_damage(surface, 0, 0, width, height);
-        wl_surface_commit(surface);
-        configured = true;
-    }
+    // acked by the render thread, so the ack and the commit of the matching state stay in order
+    push_event((struct app_event){.type = APP_EVENT_CONFIGURE, .serial = serial});
+}
+// the integer preferred scale only counts without wp_fractional_scale_v1, which is more precise
+// both need the viewport to show the larger buffer at the surface size
+static void surface_preferred_buffer_scale(void *data, struct wl_surface *surface, int32_t factor) {
+    if (viewport && !fractional_scale_manager) push_event((struct app_event){.type = APP_EVENT_SCALE, .a = factor * 120});
+}
+
+static void surface_enter(void *data, struct wl_surface *surface, struct wl_output *output) {
 }
+
+static void surface_leave(void *data, struct wl_surface *surface, struct wl_output *output) {
+}
+
+static void surface_preferred_buffer_transform(void *data, struct wl_surface *surface, uint32_t transform) {
+}
+
+static const struct wl_surface_listener surface_listener = {
+    .enter = surface_enter,
+    .leave = surface_leave,
+    .preferred_buffer_scale = surface_preferred_buffer_scale,
+    .preferred_buffer_transform = surface_preferred_buffer_transform,
+};
+
+static void fractional_preferred_scale(void *data, struct wp_fractional_scale_v1 *fractional_scale, uint32_t scale) {
+    push_event((struct app_event){.type = APP_EVENT_SCALE, .a = scale});
+}
+
+static const struct wp_fractional_scale_v1_listener fractional_scale_listener = {
+    .preferred_scale = fractional_preferred_scale,
+};
+
 static const struct xdg_surface_listener xdg_surface_listener = {
     .configure = xdg_surface_configure,
 };
 
+// a change to line alone, the next layout re-records only that line
+static void redraw_line(size_t line, size_t byte) {
+    if (dirty_line != SIZE_MAX && dirty_line != line) needs_redraw = true;
+    dirty_line = line;
+    if (byte < dirty_byte) dirty_byte = byte;
+}
+
+// keeps the cursor on a code point boundary of its line
+static void clamp_cursor(void) {
+    if (cursor_line >= document.line_count) cursor_line = document.line_count ? document.line_count - 1 : 0;
+    if (!document.line_count) return;
+    const char *s;
+    size_t length;
+    document_line(&document, cursor_line, &s, &length);
+    if (cursor_byte > length) cursor_byte = length;
+    while (cursor_byte > 0 && cursor_byte < length && ((uint8_t) s[cursor_byte] & 0xC0) == 0x80) cursor_byte--;
+}
+
+// moves the cursor to another line, scrolling it into view
+static void move_cursor_line(size_t line) {
+    const struct view view = current_view();
+    const size_t screen = screen_lines(&view);
+    cursor_line = line;
+    clamp_cursor();
+    if (cursor_line < first_line) first_line = cursor_line;
+    else if (screen > 1 && cursor_line >= first_line + screen - 1) first_line = cursor_line - (screen - 2);
+    needs_redraw = true;
+}
+
+// lines never split or join, so Return does nothing and BackSpace stops at the start of a line
+static void handle_key(uint32_t keysym, uint32_t character) {
+    if (!document.line_count) return;
+    clamp_cursor();
+    const char *s;
+    size_t length;
+    document_line(&document, cursor_line, &s, &length);
+    const size_t byte = cursor_byte;
+    uint32_t codepoint;
+    switch (keysym) {
+    case XKB_KEY_Left:
+        if (byte > 0) cursor_byte = utf8_previous(s, byte);
+        else if (cursor_line > 0) {
+            move_cursor_line(cursor_line - 1);
+            cursor_byte = SIZE_MAX;
+            clamp_cursor();
+        }
+        break;
+    case XKB_KEY_Right:
+        if (byte < length) cursor_byte += utf8_decode(s + byte, length - byte, &codepoint);
+        else if (cursor_line + 1 < document.line_count) {
+            move_cursor_line(cursor_line + 1);
+            cursor_byte = 0;
+        }
+        break;
+    case XKB_KEY_Home:
+        cursor_byte = 0;
+        break;
+    case XKB_KEY_End:
+        cursor_byte = length;
+        break;
+    case XKB_KEY_Up:
+        if (cursor_line > 0) move_cursor_line(cursor_line - 1);
+        return;
+    case XKB_KEY_Down:
+        if (cursor_line + 1 < document.line_count) move_cursor_line(cursor_line + 1);
+        return;
+    case XKB_KEY_BackSpace:
+        if (byte > 0) {
+            const size_t previous = utf8_previous(s, byte);
+            if (document_erase(&document, cursor_line, previous, byte - previous)) {
+                cursor_byte = previous;
+                redraw_line(cursor_line, previous);
+            }
+        }
+        return;
+    case XKB_KEY_Delete:
+        if (byte < length && document_erase(&document, cursor_line, byte, utf8_decode(s + byte, length - byte, &codepoint))) {
+            redraw_line(cursor_line, byte);
+        }
+        return;
+    default:
+        if (character == '\t' || (character >= 0x20 && character != 0x7F)) {
+            char bytes[4];
+            const int n = utf8_encode(character, bytes);
+            if (document_insert(&document, cursor_line, byte, bytes, n)) {
+                cursor_byte += n;
+                redraw_line(cursor_line, byte);
+            }
+        }
+        return;
+    }
+    if (cursor_byte != byte) redraw_line(cursor_line, SIZE_MAX);
+}
+
+// puts the cursor where the pointer is
+static void click_cursor(void) {
+    const struct view view = current_view();
+    const int y = to_device(pointer_y / 256) - view.font_size / 2;
+    size_t line = first_line + (y > 0 ? y / glyph_line_height(view.font_size) : 0);
+    if (line >= document.line_count) line = document.line_count ? document.line_count - 1 : 0;
+    if (!document.line_count) return;
+    const size_t byte = layout_byte_at(&document, &view, line, to_device(pointer_x / 256));
+    if (line == cursor_line && byte == cursor_byte) return;
+    if (line == cursor_line) redraw_line(line, SIZE_MAX);
+    else needs_redraw = true;
+    cursor_line = line;
+    cursor_byte = byte;
+}
+
+// applies one event to the render state
+static void handle_event(const struct app_event *event) {
+    switch (event->type) {
+    case APP_EVENT_POINTER_MOTION:
+        pointer_x = event->a;
+        pointer_y = event->b;
+        break;
+    case APP_EVENT_POINTER_BUTTON:
+        if (event->a == BTN_LEFT && event->b == WL_POINTER_BUTTON_STATE_PRESSED) {
+            click_cursor();
+        } else if (event->a == BTN_RIGHT && event->b == WL_POINTER_BUTTON_STATE_PRESSED) {
+            toggle_hud();
+        }
+        break;
+    case APP_EVENT_POINTER_AXIS:
+        if (event->a == WL_POINTER_AXIS_VERTICAL_SCROLL) {
+            first_line = layout_scroll(first_line, document.line_count, event->b, &scroll_remainder);
+            needs_redraw = true;
+            idle_add(&idle, idle_warm_glyphs, NULL);
+        }
+        break;
+    case APP_EVENT_CONFIGURE:
+        PROTOCOL_REQUEST(xdg_surface_ack_configure(xdg_surface, event->serial));
+        if (!configured) {
+            // the first frame is already laid out or on its way, this only lets it be committed
+            configured = true;
+        }
+        // a resize drag sends configures faster than we draw, only the newest size is laid out
+        if (pending_width > 0 && pending_height > 0 && (pending_width != width || pending_height != height)) {
+            width = pending_width;
+            height = pending_height;
+            needs_redraw = true;
+        }
+        break;
+    case APP_EVENT_TOPLEVEL_SIZE:
+        // 0 leaves the size to us, it takes effect with the configure that follows
+        pending_width = event->a;
+        pending_height = event->b;
+        break;
+    case APP_EVENT_FRAME_DONE:
+        frame_pending = false;
+        idle_frame_done(&idle, event->timestamp_ns);
+        // a frame already past layout keeps the compositor busy, an idle app has none
+        hud_frame_done(&hud, event->timestamp_ns, last_commit_ns, laid_out >= 0 || rasterizing >= 0 || ready_buffer >= 0);
+        if (hud_visible && event->timestamp_ns - hud_updated_ns > HUD_INTERVAL_NS) update_hud();
+        break;
+    case APP_EVENT_BUFFER_RELEASE:
+        if (event->a < BUFFER_COUNT) buffers[event->a].busy = false;
+        else hud_buffers[event->a - BUFFER_COUNT].busy = false;
+        break;
+    case APP_EVENT_CLOSE:
+        break;
+    case APP_EVENT_SCALE:
+        if (event->a > 0 && event->a != scale120) {
+            scale120 = event->a;
+            needs_redraw = true;
+        }
+        break;
+    case APP_EVENT_KEY:
+        handle_key(event->a, event->b);
+        break;
+    case APP_EVENT_CURSOR_BLINK:
+        if (cursor_visible != (event->a != 0)) {
+            cursor_visible = event->a != 0;
+            redraw_line(cursor_line, SIZE_MAX);
+        }
+        break;
+    case APP_EVENT_LOADER_READY:
+        if (loading) idle_add(&idle, idle_index_lines, NULL);
+        break;
+    }
+}
+
+// render thread: drains the queue, then moves the frame pipeline along, commits at most once per frame callback
+// the time left until the next frame is expected goes to idle work, which yields to any event
+static int render_main(void *arg) {
+    struct app_event event;
+    trace_thread_name("render");
+    pump_frames();
+    while (running) {
+        if (idle_has_work(&idle) && event_queue_empty(&events)) {
+            const uint64_t now = get_time_ns();
+            // with a commit in flight idle time ends where the next frame is expected, without one it is all idle time
+            const uint64_t deadline = frame_pending ? idle_deadline(&idle, now) : now + idle.interval_ns;
+            // work left and no frame callback to wait for: keep going
+            const uint64_t zone = trace_begin();
+            const bool more = idle_run(&idle, deadline, idle_interrupted, NULL);
+            trace_end("idle", zone);
+            if (more && !frame_pending) continue;
+        }
+        event_queue_wait(&events);
+        const uint64_t zone = trace_begin();
+        while (event_queue_pop(&events, &event)) {
+            handle_event(&event);
+        }
+        trace_end("input", zone);
+        pump_frames();
+    }
+    task_group_wait(&pool, &raster_group);
+    return 0;
+}
+
 static void registry_handle_global(void *data, struct wl_registry *registry,
                           uint32_t name, const char *interface, uint32_t version)
 {
     if (strcmp(interface, wl_seat_interface.name) == 0) {
-        seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+        // version 4 tells us the key repeat rate
+        seat = wl_registry_bind(registry, name, &wl_seat_interface, version < 4 ? version : 4);
         wl_seat_add_listener(seat, &seat_listener, NULL);
     } else if (strcmp(interface, wp_viewporter_interface.name) == 0) {
         viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+    } else if (strcmp(interface, wp_fractional_scale_manager_v1_interface.name) == 0) {
+        fractional_scale_manager = wl_registry_bind(registry, name, &wp_fractional_scale_manager_v1_interface, 1);
+    } else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+        subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
     } else if (strcmp(interface, wl_compositor_interface.name) == 0) {
-        compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 1);
+        // version 6 tells us the preferred buffer scale
+        compositor_version = version < 6 ? version : 6;
+        compositor = wl_registry_bind(registry, name, &wl_compositor_interface, compositor_version);
     } else if (strcmp(interface, wl_shm_interface.name) == 0) {
         shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
     } else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
@@ -193,7 +1016,57 @@ static const struct wl_registry_listener registry_listener = {
     .global = registry_handle_global,
 };
 
-int main() {
+// loop callback: SIGUSR1 writes the trace, SIGINT and SIGTERM end the app the way closing the window does
+static void handle_signal(void *arg, uint32_t ready) {
+    struct signalfd_siginfo info;
+    if (read((int) (intptr_t) arg, &info, sizeof(info)) != sizeof(info)) return;
+    if (info.ssi_signo != SIGUSR1) {
+        running = false;
+    } else if (trace_path && trace_write(trace_path)) {
+        printf("Trace written to %s\n", trace_path);
+    }
+}
+
+// loop callback: the read waits for the prepare_read/read_events pair in main
+static void wayland_ready(void *arg, uint32_t ready) {
+    if (ready & EPOLLIN) wayland_readable = true;
+    else if (ready & (EPOLLERR | EPOLLHUP)) running = false;
+}
+
+int main(int argc, char **argv) {
+    // TEXT_TRACE=out.json records timing zones, written on SIGUSR1 and at exit, open in ui.perfetto.dev
+    trace_path = getenv("TEXT_TRACE");
+    if (trace_path) trace_enable(true);
+    trace_thread_name("wayland");
+    // blocked in every thread, the threads started later inherit the mask, signals are only read from the signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    // read through io_uring where the kernel allows it, so rendering never faults on a mapped file
+    // wait for the first chunk, the rest is loaded in idle time
+    document_path = argc > 1 ? argv[1] : "example_text.txt";
+    loader_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loader_fd >= 0 && uring_loader_open(&loader, &document, document_path, loader_fd)) {
+        loading = true;
+        while (document.indexed < IDLE_INDEX_BYTES && !uring_loader_poll(&loader, &document, true)) {
+        }
+        if (loader.failed) reload_document();
+    } else if (document_load(&document, document_path)) {
+        // index enough for the first screen, the rest is indexed in idle time
+        document_index_lines(&document, IDLE_INDEX_BYTES);
+    } else {
+        return 1;
+    }
+    thread_pool_init(&pool, 0);
+    // rasterize ascii and the first screen on all cores while we wait for the compositor
+    const struct view view = current_view();
+    layout_prewarm(&document, &view, &pool);
+
+    xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
     display = wl_display_connect(NULL);
     struct wl_registry *registry = wl_display_get_registry(display);
     wl_registry_add_listener(registry, &registry_listener, NULL);
@@ -205,31 +1078,115 @@ int main() {
     xdg_surface_add_listener(xdg_surface, &xdg_surface_listener, NULL);
     xdg_toplevel = xdg_surface_get_toplevel(xdg_surface);
     xdg_toplevel_add_listener(xdg_toplevel, &toplevel_listener, NULL);
-    viewport = wp_viewporter_get_viewport(viewporter, surface);
+    wl_surface_add_listener(surface, &surface_listener, NULL);
+    // scale comes in as an event, the first frame may be drawn at 1 and is redrawn once it arrives
+    if (viewporter) viewport = wp_viewporter_get_viewport(viewporter, surface);
+    if (viewport && fractional_scale_manager) {
+        struct wp_fractional_scale_v1 *fractional_scale =
+            wp_fractional_scale_manager_v1_get_fractional_scale(fractional_scale_manager, surface);
+        wp_fractional_scale_v1_add_listener(fractional_scale, &fractional_scale_listener, NULL);
+    }
 
     xdg_toplevel_set_app_id(xdg_toplevel, "MAIN2.C");
     xdg_toplevel_set_title(xdg_toplevel, "MAIN2.C");
 
-    // use shared buffer for direct writes to wayland frame buffer
-    const int stride = width * 4; // 4 bytes, RGBA
-    const int size = stride * height;
-    const int fd = memfd_create("buffer", 0); // memory file descriptor
-    ftruncate(fd, size); // allocate memory for memory file
-    frame_buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0); // shared memory region
-    struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, size); // wayland buffer that reference the shared memory
-    buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride,
-                                     WL_SHM_FORMAT_ARGB8888);
-    wl_shm_pool_destroy(pool);
-    close(fd);
+    // shared memory the compositor reads our frames from directly, the wl_buffers are created at the first frame's size
+    // huge pages from the start: a frame of the initial size already fills most of one, and memory never changes kind
+    for (int i = 0; i < BUFFER_COUNT; i++) {
+        if (!shm_memory_create(&buffers[i].memory, "buffer", (size_t) width * height * 4, SHM_PAGES_HUGETLB)) {
+            fprintf(stderr, "Failed to create frame buffer memory\n");
+            return 1;
+        }
+        buffers[i].pool = wl_shm_create_pool(shm, buffers[i].memory.fd, buffers[i].memory.size);
+    }
+    printf("Frame buffers: %d in %s pages\n", BUFFER_COUNT, shm_pages_name(buffers[0].memory.pages));
 
-    draw_to_buffer(0xFFFF0000);
+    if (subcompositor) {
+        // desync: a commit on the hud surface shows right away, without a commit of the text surface
+        hud_surface = wl_compositor_create_surface(compositor);
+        hud_subsurface = wl_subcompositor_get_subsurface(subcompositor, hud_surface, surface);
+        wl_subsurface_set_position(hud_subsurface, 8, 8);
+        wl_subsurface_set_desync(hud_subsurface);
+        const int hud_size = HUD_WIDTH * HUD_HEIGHT * 4;
+        const int hud_fd = memfd_create("hud", 0);
+        ftruncate(hud_fd, hud_size * 2);
+        uint8_t *hud_memory = mmap(NULL, hud_size * 2, PROT_READ | PROT_WRITE, MAP_SHARED, hud_fd, 0);
+        struct wl_shm_pool *hud_pool = wl_shm_create_pool(shm, hud_fd, hud_size * 2);
+        for (int i = 0; i < 2; i++) {
+            hud_buffers[i].pixels = (uint32_t *) (hud_memory + i * hud_size);
+            hud_buffers[i].buffer = wl_shm_pool_create_buffer(hud_pool, i * hud_size, HUD_WIDTH, HUD_HEIGHT,
+                                                              HUD_WIDTH * 4, WL_SHM_FORMAT_ARGB8888);
+            wl_buffer_add_listener(hud_buffers[i].buffer, &buffer_listener, (void *) (intptr_t) (BUFFER_COUNT + i));
+        }
+        wl_shm_pool_destroy(hud_pool);
+        close(hud_fd);
+        // shown from the first frame on, toggled later by the render thread
+        if (getenv("TEXT_HUD")) hud_visible = true;
+    }
+
+    // initial commit without a buffer, the first frame is committed after the first configure
     wl_surface_commit(surface);
+    needs_redraw = true;
 
-    // Wait for the first configure event
-    wl_display_roundtrip(display);
+    idle_init(&idle);
+    idle_add(&idle, idle_index_lines, NULL);
+    idle_add(&idle, idle_warm_glyphs, NULL);
+    const char *record_path = getenv("TEXT_RECORD");
+    if (record_path) input_trace_open(&recorder, record_path);
+    event_queue_init(&events);
+    const int signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    repeat_timer = event_loop_timer();
+    blink_timer = event_loop_timer();
+    if (!event_loop_init(&loop) ||
+        !event_loop_add(&loop, wl_display_get_fd(display), EPOLLIN, wayland_ready, NULL) ||
+        !event_loop_add(&loop, signal_fd, EPOLLIN, handle_signal, (void *) (intptr_t) signal_fd) ||
+        !event_loop_add(&loop, repeat_timer, EPOLLIN, repeat_key, NULL) ||
+        !event_loop_add(&loop, blink_timer, EPOLLIN, blink, NULL) ||
+        (loading && !event_loop_add(&loop, loader_fd, EPOLLIN, loader_ready, NULL))) {
+        fprintf(stderr, "Failed to set up the event loop\n");
+        return 1;
+    }
+    const char *replay_path = getenv("TEXT_REPLAY");
+    if (replay_path && input_trace_load(&replay, replay_path) && replay.count) {
+        const char *speed = getenv("TEXT_REPLAY_SPEED");
+        if (speed && atof(speed) > 0) replay_speed = atof(speed);
+        replay_start_ns = get_time_ns();
+        replay_timer = event_loop_timer();
+        if (!event_loop_add(&loop, replay_timer, EPOLLIN, replay_events, NULL)) return 1;
+        event_loop_timer_set(replay_timer, 1, 0);
+    }
 
-    // loop gets triggered for every execution of a callback_add_listener (that has not been destroyed)
-    while (running && wl_display_dispatch(display) != -1) {
+    thrd_create(&render_thread, render_main, NULL);
+
+    // dispatch thread: read and dispatch events, never draws, so a slow frame cannot delay ping/pong or input
+    // every wakeup handles what is ready once, with nothing ready it sleeps in epoll_wait
+    while (running) {
+        // events already queued locally have to be dispatched before we may read new ones
+        while (wl_display_prepare_read(display) != 0) {
+            protocol_dispatch_pending(display);
+        }
+        protocol_flush(display);
+        wayland_readable = false;
+        event_loop_wait(&loop, -1);
+        if (wayland_readable) {
+            if (wl_display_read_events(display) == -1) break;
+        } else {
+            wl_display_cancel_read(display);
+        }
+        if (protocol_dispatch_pending(display) == -1) break;
     }
+    running = false;
+    push_event((struct app_event){.type = APP_EVENT_CLOSE});
+    thrd_join(render_thread, NULL);
+    if (trace_path) trace_write(trace_path);
+    protocol_stats_print(stdout);
+    printf("Dispatch thread woke up %lu times\n", (unsigned long) loop.wakeups);
+    event_loop_destroy(&loop);
+    input_trace_close(&recorder);
+    input_trace_free(&replay);
+    event_queue_destroy(&events);
+    xkb_state_unref(xkb_state);
+    xkb_keymap_unref(xkb_keymap);
+    xkb_context_unref(xkb_context);
     return 0;
 }
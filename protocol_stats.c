@@ -0,0 +1,61 @@
+#include <errno.h>
+#include <wayland-client.h>
+
+#include "protocol_stats.h"
+
+struct protocol_frame protocol_frame;
+struct protocol_stats protocol_stats;
+
+static void add(atomic_ulong *counter, unsigned long value) {
+    atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+static uint64_t take(atomic_ulong *counter) {
+    return atomic_exchange_explicit(counter, 0, memory_order_relaxed);
+}
+
+int protocol_flush(struct wl_display *display) {
+    const int sent = wl_display_flush(display);
+    add(&protocol_frame.flushes, 1);
+    if (sent > 0) add(&protocol_frame.bytes, sent);
+    // what did fit was written, the rest stays buffered in libwayland until the socket drains
+    else if (sent == -1 && errno == EAGAIN) add(&protocol_frame.eagain, 1);
+    return sent;
+}
+
+int protocol_dispatch_pending(struct wl_display *display) {
+    const int dispatched = wl_display_dispatch_pending(display);
+    add(&protocol_frame.dispatches, 1);
+    if (dispatched > 0) add(&protocol_frame.events, dispatched);
+    return dispatched;
+}
+
+void protocol_frame_end(FILE *out) {
+    const uint64_t requests = take(&protocol_frame.requests);
+    const uint64_t events = take(&protocol_frame.events);
+    const uint64_t bytes = take(&protocol_frame.bytes);
+    const uint64_t flushes = take(&protocol_frame.flushes);
+    const uint64_t dispatches = take(&protocol_frame.dispatches);
+    const uint64_t eagain = take(&protocol_frame.eagain);
+    protocol_stats.frames++;
+    protocol_stats.requests += requests;
+    protocol_stats.events += events;
+    protocol_stats.bytes += bytes;
+    protocol_stats.flushes += flushes;
+    protocol_stats.dispatches += dispatches;
+    if (requests > protocol_stats.max_requests) protocol_stats.max_requests = requests;
+    if (!eagain) return;
+    protocol_stats.eagain_frames++;
+    fprintf(out, "Frame %lu: socket buffer full in %lu of %lu flushes (%lu requests, %lu bytes flushed)\n",
+            (unsigned long) protocol_stats.frames, (unsigned long) eagain, (unsigned long) flushes,
+            (unsigned long) requests, (unsigned long) bytes);
+}
+
+void protocol_stats_print(FILE *out) {
+    const struct protocol_stats *s = &protocol_stats;
+    const double frames = s->frames ? s->frames : 1;
+    fprintf(out, "Protocol over %lu frames, per frame: %.1f requests (max %lu), %.1f events, %.0f bytes flushed, "
+                 "%.1f flushes, %.1f dispatches; %lu frames hit EAGAIN\n",
+            (unsigned long) s->frames, s->requests / frames, (unsigned long) s->max_requests, s->events / frames,
+            s->bytes / frames, s->flushes / frames, s->dispatches / frames, (unsigned long) s->eagain_frames);
+}
@@ -0,0 +1,46 @@
+#ifndef PROTOCOL_STATS_H
+#define PROTOCOL_STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+struct wl_display;
+
+// wayland traffic we cause, counted around our own calls, so excess protocol chatter shows up per frame
+// libwayland has no client side hook for outgoing requests, every request we make goes through PROTOCOL_REQUEST
+//
+//     PROTOCOL_REQUEST(wl_surface_commit(surface));
+
+// counters of the frame being produced, any thread may add to them
+struct protocol_frame {
+    atomic_ulong requests;
+    atomic_ulong events;     // events dispatched
+    atomic_ulong bytes;      // bytes flushed to the socket
+    atomic_ulong flushes;
+    atomic_ulong dispatches;
+    atomic_ulong eagain;     // flushes that stopped because the socket buffer was full
+};
+
+// totals since startup, only the thread that ends frames touches them
+struct protocol_stats {
+    uint64_t frames;
+    uint64_t requests, events, bytes, flushes, dispatches;
+    uint64_t eagain_frames; // frames where at least one flush hit EAGAIN
+    uint64_t max_requests;  // most requests in a single frame
+};
+
+extern struct protocol_frame protocol_frame;
+extern struct protocol_stats protocol_stats;
+
+#define PROTOCOL_REQUEST(call) (atomic_fetch_add_explicit(&protocol_frame.requests, 1, memory_order_relaxed), call)
+
+// wl_display_flush and wl_display_dispatch_pending with the same return values
+int protocol_flush(struct wl_display *display);
+int protocol_dispatch_pending(struct wl_display *display);
+// closes the frame at its commit, reports it to out if its flushes hit EAGAIN
+void protocol_frame_end(FILE *out);
+// per frame averages since startup
+void protocol_stats_print(FILE *out);
+
+#endif
@@ -1,2 +1,10 @@
-tcc -g -O0 main2.c xdg-shell-client-protocol.c -I. -lwayland-client -lGLESv2 -lEGL -lwayland-egl -o a.out
+set -e
+# generate the protocol headers and code that are not checked in
+protocols=/usr/share/wayland-protocols
+for xml in stable/viewporter/viewporter staging/fractional-scale/fractional-scale-v1 stable/xdg-shell/xdg-shell; do
+    name=$(basename $xml)
+    [ -f $name-client-protocol.h ] || wayland-scanner client-header $protocols/$xml.xml $name-client-protocol.h
+    [ -f $name-client-protocol.c ] || wayland-scanner private-code $protocols/$xml.xml $name-client-protocol.c
+done
+tcc -g -O0 main2.c text.c glyph.c arena.c draw_list.c layout.c cpu_draw.c thread_pool.c event_queue.c idle.c uring_loader.c trace.c hud.c input_trace.c protocol_stats.c shm_memory.c event_loop.c include/tinycthread/tinycthread.c xdg-shell-client-protocol.c viewporter-client-protocol.c fractional-scale-v1-client-protocol.c -I. -Iinclude -lwayland-client -lxkbcommon -lpthread -lGLESv2 -lEGL -lwayland-egl -o a.out
 ./a.out > /dev/null 2>&1
@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shm_memory.h"
+
+static size_t round_up(size_t size, size_t to) {
+    return (size + to - 1) / to * to;
+}
+
+// madvise on shmem succeeds either way, whether it gets huge pages depends on this setting
+static bool shmem_thp_enabled(void) {
+    FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/shmem_enabled", "r");
+    if (!f) return false;
+    char line[128] = {0};
+    fgets(line, sizeof(line), f);
+    fclose(f);
+    return strstr(line, "[always]") || strstr(line, "[within_size]") || strstr(line, "[advise]") || strstr(line, "[force]");
+}
+
+static size_t page_size(const struct shm_memory *memory) {
+    struct stat st;
+    if (memory->pages == SHM_PAGES_HUGETLB && fstat(memory->fd, &st) == 0 && st.st_blksize > 0) return st.st_blksize;
+    if (memory->pages == SHM_PAGES_TRANSPARENT) return SHM_HUGE_PAGE_SIZE;
+    return 1;
+}
+
+static bool map_memory(struct shm_memory *memory, const char *name, size_t size, unsigned flags) {
+    const int fd = memfd_create(name, MFD_CLOEXEC | flags);
+    if (fd < 0) return false;
+    if (flags & MFD_HUGETLB) {
+        // a hugetlb file reports its page size as block size
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_blksize > 0) size = round_up(size, st.st_blksize);
+    }
+    // without reserved huge pages ftruncate still works but mmap fails, that is the fallback signal
+    void *data = ftruncate(fd, size) == 0 ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    *memory = (struct shm_memory){fd, data, size, SHM_PAGES_SMALL};
+    return true;
+}
+
+bool shm_memory_create(struct shm_memory *memory, const char *name, size_t size, enum shm_pages pages) {
+    if (pages == SHM_PAGES_HUGETLB && map_memory(memory, name, size, MFD_HUGETLB)) {
+        memory->pages = SHM_PAGES_HUGETLB;
+        return true;
+    }
+    if (pages >= SHM_PAGES_TRANSPARENT && shmem_thp_enabled()) {
+        // whole huge pages, so the last one is not left to small pages
+        if (map_memory(memory, name, round_up(size, SHM_HUGE_PAGE_SIZE), 0)) {
+            if (madvise(memory->data, memory->size, MADV_HUGEPAGE) == 0) memory->pages = SHM_PAGES_TRANSPARENT;
+            return true;
+        }
+    }
+    return map_memory(memory, name, size, 0);
+}
+
+bool shm_memory_grow(struct shm_memory *memory, size_t size) {
+    if (size <= memory->size) return true;
+    if (size < memory->size + memory->size / 2) size = memory->size + memory->size / 2;
+    size = round_up(size, page_size(memory));
+    if (ftruncate(memory->fd, size) < 0) return false;
+    // mremap is not supported on hugetlb mappings by older kernels, a new mapping works everywhere
+    void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, memory->fd, 0);
+    if (data == MAP_FAILED) return false;
+    munmap(memory->data, memory->size);
+    memory->data = data;
+    memory->size = size;
+    if (memory->pages == SHM_PAGES_TRANSPARENT) madvise(data, size, MADV_HUGEPAGE);
+    return true;
+}
+
+void shm_memory_destroy(struct shm_memory *memory) {
+    if (memory->data) munmap(memory->data, memory->size);
+    if (memory->fd >= 0) close(memory->fd);
+    *memory = (struct shm_memory){.fd = -1};
+}
+
+const char *shm_pages_name(enum shm_pages pages) {
+    switch (pages) {
+    case SHM_PAGES_HUGETLB: return "hugetlb";
+    case SHM_PAGES_TRANSPARENT: return "transparent huge";
+    default: return "small";
+    }
+}
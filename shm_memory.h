@@ -0,0 +1,33 @@
+#ifndef SHM_MEMORY_H
+#define SHM_MEMORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// memory file for wl_shm buffers, backed by huge pages when the system has them
+// a full frame at 4k is 32 MB, with 4 KB pages writing it walks through 8000 TLB entries, with 2 MB pages 16
+enum shm_pages {
+    SHM_PAGES_SMALL,       // plain memfd
+    SHM_PAGES_TRANSPARENT, // memfd with MADV_HUGEPAGE, needs shmem THP enabled (transparent_hugepage/shmem_enabled)
+    SHM_PAGES_HUGETLB,     // MFD_HUGETLB, needs reserved huge pages (vm.nr_hugepages)
+};
+
+#define SHM_HUGE_PAGE_SIZE (2u << 20)
+
+struct shm_memory {
+    int fd;             // stays open, wl_shm_create_pool takes it
+    uint8_t *data;
+    size_t size;        // may be rounded up to whole huge pages
+    enum shm_pages pages; // what was actually set up
+};
+
+// tries pages first and falls back to the smaller kinds, returns false only if even a plain memfd fails
+bool shm_memory_create(struct shm_memory *memory, const char *name, size_t size, enum shm_pages pages);
+// grows to at least size, and by half at a time so a resize drag only grows a handful of times
+// never shrinks, a smaller buffer reuses what is there; data moves, the content is kept
+bool shm_memory_grow(struct shm_memory *memory, size_t size);
+void shm_memory_destroy(struct shm_memory *memory);
+const char *shm_pages_name(enum shm_pages pages);
+
+#endif
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "text.h"
+
+int utf8_decode(const char *str, size_t n, uint32_t *codepoint) {
+    const uint8_t *s = (const uint8_t *) str;
+    if (n == 0) {
+        *codepoint = 0;
+        return 0;
+    }
+    if (s[0] < 0x80) {
+        *codepoint = s[0];
+        return 1;
+    }
+    int length;
+    uint32_t cp, min;
+    if ((s[0] & 0xE0) == 0xC0) { length = 2; cp = s[0] & 0x1F; min = 0x80; }
+    else if ((s[0] & 0xF0) == 0xE0) { length = 3; cp = s[0] & 0x0F; min = 0x800; }
+    else if ((s[0] & 0xF8) == 0xF0) { length = 4; cp = s[0] & 0x07; min = 0x10000; }
+    else { *codepoint = UTF8_INVALID; return 1; }
+    if ((size_t) length > n) {
+        *codepoint = UTF8_INVALID;
+        return 1;
+    }
+    for (int i = 1; i < length; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *codepoint = UTF8_INVALID;
+            return i;
+        }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    // overlong encodings, surrogates and out of range values
+    if (cp < min || cp > 0x10FFFF || (cp >= 0xD800 && cp <= 0xDFFF)) cp = UTF8_INVALID;
+    *codepoint = cp;
+    return length;
+}
+
+size_t utf8_validate(const char *str, size_t n, size_t *errors) {
+    const uint8_t *s = (const uint8_t *) str;
+    size_t i = 0;
+    while (i < n) {
+        // ascii fast path, 8 bytes at a time
+        if (i + 8 <= n) {
+            uint64_t word;
+            memcpy(&word, s + i, 8);
+            if (!(word & 0x8080808080808080ull)) {
+                i += 8;
+                continue;
+            }
+        }
+        if (s[i] < 0x80) {
+            i++;
+            continue;
+        }
+        const int length = (s[i] & 0xE0) == 0xC0 ? 2 : (s[i] & 0xF0) == 0xE0 ? 3 : (s[i] & 0xF8) == 0xF0 ? 4 : 1;
+        if (i + length > n) break;
+        uint32_t codepoint;
+        const int used = utf8_decode(str + i, n - i, &codepoint);
+        // an encoded U+FFFD is valid
+        if (codepoint == UTF8_INVALID && !(used == 3 && memcmp(s + i, "\xEF\xBF\xBD", 3) == 0)) (*errors)++;
+        i += used;
+    }
+    return i;
+}
+
+bool document_load(struct document *doc, const char *path) {
+    memset(doc, 0, sizeof(*doc));
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return false;
+    }
+    doc->size = st.st_size;
+    if (doc->size > 0) {
+        void *data = mmap(NULL, doc->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "Failed to mmap %s\n", path);
+            close(fd);
+            return false;
+        }
+        doc->data = data;
+    }
+    close(fd);
+    doc->line_capacity = 1024;
+    doc->line_starts = malloc(doc->line_capacity * sizeof(size_t));
+    doc->line_starts[0] = 0;
+    doc->line_count = 1;
+    doc->generation = 1;
+    return true;
+}
+
+void document_free(struct document *doc) {
+    if (doc->data) munmap((void *) doc->data, doc->size);
+    free(doc->line_starts);
+    for (size_t i = 0; i < doc->edit_count; i++) free(doc->edits[i].text);
+    free(doc->edits);
+    memset(doc, 0, sizeof(*doc));
+}
+
+bool document_index_lines(struct document *doc, size_t max_bytes) {
+    size_t end = doc->indexed + max_bytes;
+    if (end > doc->size || end < doc->indexed) end = doc->size;
+    const char *p = doc->data + doc->indexed;
+    const char *stop = doc->data + end;
+    while (p < stop && (p = memchr(p, '\n', stop - p))) {
+        p++;
+        if (doc->line_count == doc->line_capacity) {
+            doc->line_capacity *= 2;
+            doc->line_starts = realloc(doc->line_starts, doc->line_capacity * sizeof(size_t));
+        }
+        doc->line_starts[doc->line_count++] = p - doc->data;
+    }
+    doc->indexed = end;
+    return doc->indexed == doc->size;
+}
+
+// index of the first edit at or after line, the edits are sorted by line
+static size_t edit_position(const struct document *doc, size_t line) {
+    size_t low = 0, high = doc->edit_count;
+    while (low < high) {
+        const size_t middle = low + (high - low) / 2;
+        if (doc->edits[middle].line < line) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+static struct line_edit *find_edit(const struct document *doc, size_t line) {
+    const size_t i = edit_position(doc, line);
+    return i < doc->edit_count && doc->edits[i].line == line ? &doc->edits[i] : NULL;
+}
+
+void document_line(const struct document *doc, size_t line, const char **start, size_t *length) {
+    const struct line_edit *edit = doc->edit_count ? find_edit(doc, line) : NULL;
+    if (edit) {
+        *start = edit->text;
+        *length = edit->length;
+        return;
+    }
+    const size_t begin = doc->line_starts[line];
+    size_t end = line + 1 < doc->line_count ? doc->line_starts[line + 1] - 1 : doc->indexed;
+    if (end > begin && doc->data[end - 1] == '\r') end--;
+    *start = doc->data + begin;
+    *length = end - begin;
+}
+
+size_t utf8_previous(const char *s, size_t i) {
+    if (i == 0) return 0;
+    size_t start = i - 1;
+    while (start > 0 && i - start < 4 && ((uint8_t) s[start] & 0xC0) == 0x80) start--;
+    return start;
+}
+
+int utf8_encode(uint32_t codepoint, char *out) {
+    if (codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint < 0xE000)) codepoint = UTF8_INVALID;
+    if (codepoint < 0x80) {
+        out[0] = codepoint;
+        return 1;
+    }
+    if (codepoint < 0x800) {
+        out[0] = 0xC0 | codepoint >> 6;
+        out[1] = 0x80 | (codepoint & 0x3F);
+        return 2;
+    }
+    if (codepoint < 0x10000) {
+        out[0] = 0xE0 | codepoint >> 12;
+        out[1] = 0x80 | (codepoint >> 6 & 0x3F);
+        out[2] = 0x80 | (codepoint & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | codepoint >> 18;
+    out[1] = 0x80 | (codepoint >> 12 & 0x3F);
+    out[2] = 0x80 | (codepoint >> 6 & 0x3F);
+    out[3] = 0x80 | (codepoint & 0x3F);
+    return 4;
+}
+
+// the edit buffer of line, created from the file's bytes on the first edit, with room for n more bytes
+static struct line_edit *edit_line(struct document *doc, size_t line, size_t n) {
+    // the last line may still grow while the index catches up
+    if (line >= doc->line_count || (line + 1 == doc->line_count && doc->indexed < doc->size)) return NULL;
+    struct line_edit *edit = find_edit(doc, line);
+    if (!edit) {
+        if (doc->edit_count == doc->edit_capacity) {
+            const size_t capacity = doc->edit_capacity ? doc->edit_capacity * 2 : 16;
+            struct line_edit *edits = realloc(doc->edits, capacity * sizeof(*edits));
+            if (!edits) return NULL;
+            doc->edits = edits;
+            doc->edit_capacity = capacity;
+        }
+        const char *s;
+        size_t length;
+        document_line(doc, line, &s, &length);
+        char *text = malloc(length + 64);
+        if (!text) return NULL;
+        memcpy(text, s, length);
+        const size_t i = edit_position(doc, line);
+        memmove(&doc->edits[i + 1], &doc->edits[i], (doc->edit_count - i) * sizeof(*doc->edits));
+        doc->edit_count++;
+        edit = &doc->edits[i];
+        *edit = (struct line_edit){line, text, length, length + 64};
+    }
+    if (edit->length + n > edit->capacity) {
+        size_t capacity = edit->capacity * 2;
+        while (capacity < edit->length + n) capacity *= 2;
+        char *text = realloc(edit->text, capacity);
+        if (!text) return NULL;
+        edit->text = text;
+        edit->capacity = capacity;
+    }
+    return edit;
+}
+
+bool document_insert(struct document *doc, size_t line, size_t at, const char *bytes, size_t n) {
+    struct line_edit *edit = edit_line(doc, line, n);
+    if (!edit || at > edit->length) return false;
+    memmove(edit->text + at + n, edit->text + at, edit->length - at);
+    memcpy(edit->text + at, bytes, n);
+    edit->length += n;
+    doc->generation++;
+    return true;
+}
+
+bool document_erase(struct document *doc, size_t line, size_t at, size_t n) {
+    struct line_edit *edit = edit_line(doc, line, 0);
+    if (!edit || at > edit->length || n > edit->length - at) return false;
+    memmove(edit->text + at, edit->text + at + n, edit->length - at - n);
+    edit->length -= n;
+    doc->generation++;
+    return true;
+}
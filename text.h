@@ -0,0 +1,54 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// replacement character for invalid utf-8
+#define UTF8_INVALID 0xFFFD
+
+// decodes one code point, returns the number of bytes consumed (at least 1 if n > 0)
+int utf8_decode(const char *s, size_t n, uint32_t *codepoint);
+// adds the number of invalid sequences in s to errors, returns the number of bytes checked
+// a sequence cut off by the end of s is left unchecked, so chunks can be validated as they arrive
+size_t utf8_validate(const char *s, size_t n, size_t *errors);
+
+// start of the code point that ends at byte i of s, i itself if i == 0
+size_t utf8_previous(const char *s, size_t i);
+// writes codepoint as 1 to 4 bytes, returns how many
+int utf8_encode(uint32_t codepoint, char *out);
+
+// an edited line lives in its own buffer, so the file data stays read-only and the line index stays valid
+struct line_edit {
+    size_t line;
+    char *text;
+    size_t length, capacity;
+};
+
+// a read-only document with a line index that can be built incrementally, and edits within lines on top
+struct document {
+    const char *data;
+    size_t size;
+    size_t *line_starts;  // byte offset of the start of every indexed line
+    size_t line_count;
+    size_t line_capacity;
+    size_t indexed;       // bytes scanned for line starts so far
+    uint32_t generation;  // bumped whenever the visible content changes
+    struct line_edit *edits; // sorted by line, every document_line looks it up
+    size_t edit_count, edit_capacity;
+};
+
+bool document_load(struct document *doc, const char *path);
+void document_free(struct document *doc);
+// scans at most max_bytes further for line starts, returns true once the whole document is indexed
+bool document_index_lines(struct document *doc, size_t max_bytes);
+// byte range of line i without the newline, the line must be indexed
+void document_line(const struct document *doc, size_t line, const char **start, size_t *length);
+// inserts n bytes at byte offset at of line, returns false if the line is not fully indexed yet or out of memory
+// lines never split or join, a newline in bytes would break the line index
+bool document_insert(struct document *doc, size_t line, size_t at, const char *bytes, size_t n);
+// removes n bytes at byte offset at of line
+bool document_erase(struct document *doc, size_t line, size_t at, size_t n);
+
+#endif
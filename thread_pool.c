@@ -0,0 +1,195 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "thread_pool.h"
+
+struct worker_start {
+    struct thread_pool *pool;
+    int index;
+};
+
+static void deque_init(struct task_deque *deque) {
+    mtx_init(&deque->lock, mtx_plain);
+    deque->capacity = 256;
+    deque->tasks = malloc(deque->capacity * sizeof(struct task));
+    deque->head = deque->tail = 0;
+}
+
+static void deque_push(struct task_deque *deque, struct task task) {
+    mtx_lock(&deque->lock);
+    if (deque->tail - deque->head == deque->capacity) {
+        // full: grow and unwrap the ring
+        struct task *tasks = malloc(deque->capacity * 2 * sizeof(struct task));
+        for (int i = 0; i < deque->capacity; i++) tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->tail = deque->capacity;
+        deque->head = 0;
+        deque->capacity *= 2;
+    }
+    deque->tasks[deque->tail % deque->capacity] = task;
+    deque->tail++;
+    mtx_unlock(&deque->lock);
+}
+
+// owner end: newest task first, it is the one most likely still in cache
+static bool deque_pop(struct task_deque *deque, struct task *task) {
+    mtx_lock(&deque->lock);
+    const bool found = deque->tail > deque->head;
+    if (found) *task = deque->tasks[--deque->tail % deque->capacity];
+    mtx_unlock(&deque->lock);
+    return found;
+}
+
+// thief end: oldest task first, usually the biggest chunk of remaining work
+static bool deque_steal(struct task_deque *deque, struct task *task) {
+    if (mtx_trylock(&deque->lock) != thrd_success) return false; // busy, try another victim
+    const bool found = deque->tail > deque->head;
+    if (found) {
+        *task = deque->tasks[deque->head % deque->capacity];
+        deque->head++;
+        if (deque->head == deque->tail) deque->head = deque->tail = 0;
+    }
+    mtx_unlock(&deque->lock);
+    return found;
+}
+
+int thread_pool_worker_index(struct thread_pool *pool) {
+    const intptr_t index = (intptr_t) tss_get(pool->worker_key);
+    return index ? (int) index - 1 : pool->worker_count;
+}
+
+// own deque first, then the injection deque, then steal round robin starting at a neighbour
+static bool find_task(struct thread_pool *pool, int self, struct task *task) {
+    const int count = pool->worker_count + 1;
+    if (deque_pop(&pool->deques[self], task)) return true;
+    for (int i = 1; i <= count; i++) {
+        const int victim = (self + i) % count;
+        if (deque_steal(&pool->deques[victim], task)) return true;
+    }
+    return false;
+}
+
+static void run_task(struct thread_pool *pool, struct task *task) {
+    atomic_fetch_sub_explicit(&pool->queued, 1, memory_order_relaxed);
+    task->fn(task->arg);
+    if (task->group) atomic_fetch_sub_explicit(&task->group->pending, 1, memory_order_release);
+}
+
+static int worker_main(void *data) {
+    struct worker_start start = *(struct worker_start *) data;
+    free(data);
+    struct thread_pool *pool = start.pool;
+    tss_set(pool->worker_key, (void *) (intptr_t) (start.index + 1));
+    struct task task;
+    while (!atomic_load(&pool->stop)) {
+        if (find_task(pool, start.index, &task)) {
+            run_task(pool, &task);
+            continue;
+        }
+        // nothing anywhere: sleep until a submit signals, queued is rechecked under the lock so no wakeup is lost
+        mtx_lock(&pool->sleep_lock);
+        while (atomic_load(&pool->queued) == 0 && !atomic_load(&pool->stop)) {
+            cnd_wait(&pool->wake, &pool->sleep_lock);
+        }
+        mtx_unlock(&pool->sleep_lock);
+    }
+    return 0;
+}
+
+bool thread_pool_init(struct thread_pool *pool, int threads) {
+    if (threads <= 0) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 1 ? (int) cores - 1 : 1;
+    }
+    pool->worker_count = threads;
+    atomic_init(&pool->queued, 0);
+    atomic_init(&pool->stop, false);
+    mtx_init(&pool->sleep_lock, mtx_plain);
+    cnd_init(&pool->wake);
+    if (tss_create(&pool->worker_key, NULL) != thrd_success) {
+        fprintf(stderr, "Failed to create thread pool key\n");
+        return false;
+    }
+    pool->deques = malloc((threads + 1) * sizeof(struct task_deque));
+    for (int i = 0; i <= threads; i++) deque_init(&pool->deques[i]);
+    pool->threads = malloc(threads * sizeof(thrd_t));
+    for (int i = 0; i < threads; i++) {
+        struct worker_start *start = malloc(sizeof(*start));
+        *start = (struct worker_start){pool, i};
+        if (thrd_create(&pool->threads[i], worker_main, start) != thrd_success) {
+            fprintf(stderr, "Failed to start worker %d\n", i);
+            free(start);
+            pool->worker_count = i;
+            break;
+        }
+    }
+    return pool->worker_count > 0;
+}
+
+void thread_pool_destroy(struct thread_pool *pool) {
+    mtx_lock(&pool->sleep_lock);
+    atomic_store(&pool->stop, true);
+    cnd_broadcast(&pool->wake);
+    mtx_unlock(&pool->sleep_lock);
+    for (int i = 0; i < pool->worker_count; i++) thrd_join(pool->threads[i], NULL);
+    for (int i = 0; i <= pool->worker_count; i++) {
+        mtx_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].tasks);
+    }
+    free(pool->deques);
+    free(pool->threads);
+    tss_delete(pool->worker_key);
+    cnd_destroy(&pool->wake);
+    mtx_destroy(&pool->sleep_lock);
+}
+
+void task_group_run(struct thread_pool *pool, struct task_group *group, task_fn fn, void *arg) {
+    atomic_fetch_add_explicit(&group->pending, 1, memory_order_relaxed);
+    deque_push(&pool->deques[thread_pool_worker_index(pool)], (struct task){fn, arg, group});
+    atomic_fetch_add(&pool->queued, 1);
+    mtx_lock(&pool->sleep_lock);
+    cnd_signal(&pool->wake);
+    mtx_unlock(&pool->sleep_lock);
+}
+
+void task_group_wait(struct thread_pool *pool, struct task_group *group) {
+    const int self = thread_pool_worker_index(pool);
+    struct task task;
+    while (atomic_load_explicit(&group->pending, memory_order_acquire) > 0) {
+        if (find_task(pool, self, &task)) run_task(pool, &task);
+        else thrd_yield(); // the last tasks are running elsewhere
+    }
+}
+
+// parallel_for hands out chunks from a shared counter, so fast threads simply take more of them
+struct parallel_for_job {
+    parallel_for_fn fn;
+    void *arg;
+    atomic_int next;
+    int end, grain;
+};
+
+static void parallel_for_task(void *data) {
+    struct parallel_for_job *job = data;
+    for (;;) {
+        const int begin = atomic_fetch_add_explicit(&job->next, job->grain, memory_order_relaxed);
+        if (begin >= job->end) break;
+        job->fn(job->arg, begin, begin + job->grain < job->end ? begin + job->grain : job->end);
+    }
+}
+
+void parallel_for(struct thread_pool *pool, int begin, int end, int grain, parallel_for_fn fn, void *arg) {
+    if (end <= begin) return;
+    if (grain < 1) grain = 1;
+    const int chunks = (end - begin + grain - 1) / grain;
+    struct parallel_for_job job = {fn, arg, begin, end, grain};
+    struct task_group group = {0};
+    // one task per helper, the calling thread works on the job too
+    const int helpers = chunks - 1 < pool->worker_count ? chunks - 1 : pool->worker_count;
+    for (int i = 0; i < helpers; i++) task_group_run(pool, &group, parallel_for_task, &job);
+    parallel_for_task(&job);
+    task_group_wait(pool, &group);
+}
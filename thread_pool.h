@@ -0,0 +1,58 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "tinycthread/tinycthread.h"
+
+// work-stealing pool: every worker owns a deque, pops its own work from the back and steals from the front of others
+// threads that are not workers (e.g. the wayland dispatch thread) submit into a shared injection deque
+// and help run tasks while they wait on a group, so a pool of n threads keeps n + 1 cores busy
+
+typedef void (*task_fn)(void *arg);
+
+// tasks run in a group can be waited on together
+struct task_group {
+    atomic_int pending;
+};
+
+struct task {
+    task_fn fn;
+    void *arg;
+    struct task_group *group;
+};
+
+struct task_deque {
+    mtx_t lock; // held only for a push, pop or steal
+    struct task *tasks;
+    int head, tail, capacity; // ring, [head, tail) are queued
+};
+
+struct thread_pool {
+    int worker_count;
+    thrd_t *threads;
+    struct task_deque *deques; // worker_count + 1, the last one is the injection deque
+    atomic_int queued;         // tasks in all deques, workers sleep when it is 0
+    atomic_bool stop;
+    mtx_t sleep_lock;
+    cnd_t wake;
+    tss_t worker_key;          // worker index + 1 of the calling thread, 0 (NULL) outside the pool
+};
+
+// threads <= 0 picks one worker per core, minus the submitting thread
+bool thread_pool_init(struct thread_pool *pool, int threads);
+void thread_pool_destroy(struct thread_pool *pool);
+// index of the calling worker in [0, worker_count), or worker_count for threads outside the pool
+// meant for indexing per-thread data (scratch memory, staging buffers)
+int thread_pool_worker_index(struct thread_pool *pool);
+
+void task_group_run(struct thread_pool *pool, struct task_group *group, task_fn fn, void *arg);
+// runs queued tasks on the calling thread until every task of the group finished
+void task_group_wait(struct thread_pool *pool, struct task_group *group);
+
+// calls fn(arg, i0, i1) for consecutive ranges of at most grain items covering [begin, end), returns when all are done
+typedef void (*parallel_for_fn)(void *arg, int begin, int end);
+void parallel_for(struct thread_pool *pool, int begin, int end, int grain, parallel_for_fn fn, void *arg);
+
+#endif
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+#include "helper/util.h"
+#include "tinycthread/tinycthread.h"
+
+atomic_bool trace_enabled = false;
+
+static _Atomic(struct trace_ring *) trace_rings;
+static atomic_int trace_ring_count;
+static tss_t trace_key;
+static once_flag trace_once = ONCE_FLAG_INIT;
+
+static void trace_create_key(void) {
+    tss_create(&trace_key, NULL);
+}
+
+// rings are never freed, a thread that exits leaves its events for the next trace_write
+static struct trace_ring *trace_ring(void) {
+    call_once(&trace_once, trace_create_key);
+    struct trace_ring *ring = tss_get(trace_key);
+    if (ring) return ring;
+    ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+    ring->tid = atomic_fetch_add(&trace_ring_count, 1) + 1;
+    snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %d", ring->tid);
+    ring->next = atomic_load(&trace_rings);
+    while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring)) {
+    }
+    tss_set(trace_key, ring);
+    return ring;
+}
+
+void trace_enable(bool enable) {
+    atomic_store(&trace_enabled, enable);
+}
+
+void trace_thread_name(const char *name) {
+    struct trace_ring *ring = trace_ring();
+    if (ring) snprintf(ring->thread_name, sizeof(ring->thread_name), "%s", name);
+}
+
+uint64_t trace_begin(void) {
+    if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) return 0;
+    return get_time_ns();
+}
+
+void trace_end(const char *name, uint64_t begin_ns) {
+    if (!begin_ns) return;
+    const uint64_t end_ns = get_time_ns();
+    struct trace_ring *ring = trace_ring();
+    if (!ring) return;
+    const unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    ring->events[head & (TRACE_RING_SIZE - 1)] = (struct trace_event){name, begin_ns, end_ns};
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+bool trace_write(const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return false;
+    }
+    struct trace_event *events = malloc(TRACE_RING_SIZE * sizeof(*events));
+    if (!events) {
+        fclose(f);
+        return false;
+    }
+    // timestamps relative to the oldest event keep the numbers short
+    uint64_t origin = UINT64_MAX;
+    for (struct trace_ring *ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+        const unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        const unsigned first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        if (head > first && ring->events[first & (TRACE_RING_SIZE - 1)].begin_ns < origin) {
+            origin = ring->events[first & (TRACE_RING_SIZE - 1)].begin_ns;
+        }
+    }
+    fprintf(f, "{\"traceEvents\": [\n");
+    bool comma = false;
+    for (struct trace_ring *ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+        fprintf(f, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                comma ? ",\n" : "", ring->tid, ring->thread_name);
+        comma = true;
+        // copy, then drop whatever the owner overwrote while we were copying
+        const unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        unsigned first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+        for (unsigned i = first; i != head; i++) events[i - first] = ring->events[i & (TRACE_RING_SIZE - 1)];
+        const unsigned now = atomic_load_explicit(&ring->head, memory_order_acquire);
+        const unsigned valid = now > TRACE_RING_SIZE && now - TRACE_RING_SIZE > first ? now - TRACE_RING_SIZE : first;
+        for (unsigned i = valid; i != head; i++) {
+            const struct trace_event *e = &events[i - first];
+            fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                    e->name, ring->tid, (e->begin_ns - origin) / 1000.0, (e->end_ns - e->begin_ns) / 1000.0);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    free(events);
+    fclose(f);
+    return true;
+}
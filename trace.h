@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// timing zones for chrome://tracing and ui.perfetto.dev
+// every thread writes complete events into its own ring, nothing is shared while recording
+// disabled tracing costs one relaxed load per zone
+//
+//     const uint64_t zone = trace_begin();
+//     ...
+//     trace_end("layout", zone);
+
+#define TRACE_RING_SIZE 16384 // events per thread, power of two, the oldest are overwritten
+
+struct trace_event {
+    const char *name; // must outlive the trace, string literals
+    uint64_t begin_ns, end_ns;
+};
+
+struct trace_ring {
+    struct trace_ring *next; // list of all rings, walked by trace_write
+    int tid;
+    char thread_name[32];
+    atomic_uint head;        // events written so far, only the owning thread writes
+    struct trace_event events[TRACE_RING_SIZE];
+};
+
+extern atomic_bool trace_enabled;
+
+void trace_enable(bool enable);
+// names the calling thread in the trace
+void trace_thread_name(const char *name);
+// returns the start of a zone, 0 if tracing is off
+uint64_t trace_begin(void);
+void trace_end(const char *name, uint64_t begin_ns);
+// writes what the rings hold as trace_event JSON, safe while other threads keep recording
+bool trace_write(const char *path);
+
+#endif
@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "uring_loader.h"
+
+// no liburing, the three syscalls and the ring layout are all it takes
+static int io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// the kernel reads the sq tail and writes the cq tail concurrently
+static unsigned load_acquire(unsigned *p) {
+    return atomic_load_explicit((_Atomic unsigned *) p, memory_order_acquire);
+}
+
+static void store_release(unsigned *p, unsigned value) {
+    atomic_store_explicit((_Atomic unsigned *) p, value, memory_order_release);
+}
+
+// a ring can come up on a kernel that predates IORING_OP_READ (5.6), every read would fail then
+static bool read_supported(int ring_fd) {
+    const unsigned ops = IORING_OP_READ + 1;
+    struct io_uring_probe *probe = calloc(1, sizeof(*probe) + ops * sizeof(struct io_uring_probe_op));
+    if (!probe) return false;
+    const bool supported = io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, ops) >= 0 &&
+                           probe->last_op >= IORING_OP_READ &&
+                           (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return supported;
+}
+
+static bool ring_init(struct uring_loader *loader, int event_fd) {
+    struct io_uring_params params = {0};
+    loader->ring_fd = io_uring_setup(URING_QUEUE_DEPTH, &params);
+    if (loader->ring_fd < 0 || !read_supported(loader->ring_fd)) return false;
+    if (event_fd >= 0 && io_uring_register(loader->ring_fd, IORING_REGISTER_EVENTFD, &event_fd, 1) < 0) return false;
+    loader->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    loader->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    // older kernels map the two rings separately
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (loader->cq_ring_size > loader->sq_ring_size) loader->sq_ring_size = loader->cq_ring_size;
+        loader->cq_ring_size = loader->sq_ring_size;
+    }
+    loader->sq_ring = mmap(NULL, loader->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                           loader->ring_fd, IORING_OFF_SQ_RING);
+    if (loader->sq_ring == MAP_FAILED) return false;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        loader->cq_ring = loader->sq_ring;
+    } else {
+        loader->cq_ring = mmap(NULL, loader->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               loader->ring_fd, IORING_OFF_CQ_RING);
+        if (loader->cq_ring == MAP_FAILED) return false;
+    }
+    loader->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, loader->ring_fd, IORING_OFF_SQES);
+    if (loader->sqes == MAP_FAILED) return false;
+    uint8_t *sq = loader->sq_ring, *cq = loader->cq_ring;
+    loader->sq_head = (unsigned *) (sq + params.sq_off.head);
+    loader->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    loader->sq_mask = (unsigned *) (sq + params.sq_off.ring_mask);
+    loader->sq_array = (unsigned *) (sq + params.sq_off.array);
+    loader->cq_head = (unsigned *) (cq + params.cq_off.head);
+    loader->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    loader->cq_mask = (unsigned *) (cq + params.cq_off.ring_mask);
+    loader->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return true;
+}
+
+// queues a read of the rest of chunk, the kernel picks it up on the next io_uring_enter
+static void queue_read(struct uring_loader *loader, struct document *doc, size_t chunk) {
+    const size_t offset = chunk * URING_CHUNK_SIZE + loader->chunk_read[chunk];
+    size_t length = doc->size - chunk * URING_CHUNK_SIZE;
+    if (length > URING_CHUNK_SIZE) length = URING_CHUNK_SIZE;
+    length -= loader->chunk_read[chunk];
+    const unsigned tail = *loader->sq_tail;
+    const unsigned index = tail & *loader->sq_mask;
+    struct io_uring_sqe *sqe = &loader->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loader->file_fd;
+    sqe->off = offset;
+    sqe->addr = (uintptr_t) (doc->data + offset);
+    sqe->len = length;
+    sqe->user_data = chunk;
+    loader->sq_array[index] = index;
+    store_release(loader->sq_tail, tail + 1);
+    loader->queued++;
+}
+
+// submits the queued reads and waits for min_complete of them, false if the ring is unusable
+static bool ring_enter(struct uring_loader *loader, unsigned min_complete) {
+    for (;;) {
+        const int submitted = io_uring_enter(loader->ring_fd, loader->queued, min_complete,
+                                             min_complete ? IORING_ENTER_GETEVENTS : 0);
+        if (submitted >= 0) {
+            // the kernel may take fewer than asked, the rest stay in the sq ring for the next call
+            loader->queued -= submitted;
+            loader->in_flight += submitted;
+            return true;
+        }
+        // a signal cut the wait short before anything was submitted
+        if (errno == EINTR) continue;
+        // out of memory for now or completions backed up, they get reaped and the next poll tries again
+        return errno == EAGAIN || errno == EBUSY;
+    }
+}
+
+bool uring_loader_open(struct uring_loader *loader, struct document *doc, const char *path, int event_fd) {
+    memset(loader, 0, sizeof(*loader));
+    loader->ring_fd = loader->file_fd = -1;
+    memset(doc, 0, sizeof(*doc));
+    loader->file_fd = open(path, O_RDONLY);
+    struct stat st;
+    if (loader->file_fd < 0 || fstat(loader->file_fd, &st) < 0 || st.st_size == 0 || !ring_init(loader, event_fd)) {
+        uring_loader_close(loader);
+        return false;
+    }
+    // anonymous memory, populated now so neither the reads nor the renderer ever fault on it later
+    doc->size = st.st_size;
+    void *data = mmap(NULL, doc->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    loader->chunk_count = (doc->size + URING_CHUNK_SIZE - 1) / URING_CHUNK_SIZE;
+    loader->chunk_read = calloc(loader->chunk_count, sizeof(*loader->chunk_read));
+    if (data == MAP_FAILED || !loader->chunk_read) {
+        if (data != MAP_FAILED) munmap(data, doc->size);
+        memset(doc, 0, sizeof(*doc));
+        uring_loader_close(loader);
+        return false;
+    }
+    doc->data = data;
+    doc->line_capacity = 1024;
+    doc->line_starts = malloc(doc->line_capacity * sizeof(size_t));
+    if (!doc->line_starts) {
+        munmap(data, doc->size);
+        memset(doc, 0, sizeof(*doc));
+        uring_loader_close(loader);
+        return false;
+    }
+    doc->line_starts[0] = 0;
+    doc->line_count = 1;
+    doc->generation = 1;
+    return true;
+}
+
+bool uring_loader_poll(struct uring_loader *loader, struct document *doc, bool wait) {
+    if (loader->failed) return true;
+    // keep the queue full
+    while (loader->queued + loader->in_flight < URING_QUEUE_DEPTH && loader->next_chunk < loader->chunk_count) {
+        queue_read(loader, doc, loader->next_chunk++);
+    }
+    if (loader->queued || wait) {
+        const unsigned min_complete = wait && loader->queued + loader->in_flight ? 1 : 0;
+        if (!ring_enter(loader, min_complete)) {
+            loader->failed = true;
+            return true;
+        }
+    }
+    // reap
+    unsigned head = *loader->cq_head;
+    const unsigned tail = load_acquire(loader->cq_tail);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe *cqe = &loader->cqes[head & *loader->cq_mask];
+        const size_t chunk = cqe->user_data;
+        loader->in_flight--;
+        if (cqe->res <= 0) {
+            // the other reads in flight usually fail the same way, the first one says enough
+            const size_t offset = chunk * URING_CHUNK_SIZE + loader->chunk_read[chunk];
+            if (!loader->failed && cqe->res < 0) {
+                fprintf(stderr, "io_uring read failed at %zu: %s\n", offset, strerror(-cqe->res));
+            } else if (!loader->failed) {
+                // the file is shorter than when it was opened
+                fprintf(stderr, "io_uring read hit an unexpected end of file at %zu\n", offset);
+            }
+            loader->failed = true;
+            continue;
+        }
+        loader->chunk_read[chunk] += cqe->res;
+        size_t length = doc->size - chunk * URING_CHUNK_SIZE;
+        if (length > URING_CHUNK_SIZE) length = URING_CHUNK_SIZE;
+        // short read, ask for the rest
+        if (loader->chunk_read[chunk] < length) {
+            queue_read(loader, doc, chunk);
+        }
+    }
+    store_release(loader->cq_head, head);
+    if (loader->queued && !ring_enter(loader, 0)) loader->failed = true;
+    if (loader->failed) return true;
+
+    // everything up to the first incomplete chunk can go through the later stages
+    size_t loaded = loader->loaded;
+    for (size_t chunk = loaded / URING_CHUNK_SIZE; chunk < loader->chunk_count; chunk++) {
+        size_t length = doc->size - chunk * URING_CHUNK_SIZE;
+        if (length > URING_CHUNK_SIZE) length = URING_CHUNK_SIZE;
+        if (loader->chunk_read[chunk] < length) break;
+        loaded = chunk * URING_CHUNK_SIZE + length;
+    }
+    if (loaded != loader->loaded) {
+        loader->loaded = loaded;
+        document_index_lines(doc, loaded - doc->indexed);
+        loader->validated += utf8_validate(doc->data + loader->validated, loaded - loader->validated,
+                                           &loader->utf8_errors);
+    }
+    if (loaded < doc->size) return false;
+    // a sequence cut off by the end of the file
+    if (loader->validated < doc->size) {
+        loader->utf8_errors++;
+        loader->validated = doc->size;
+    }
+    if (loader->utf8_errors) {
+        fprintf(stderr, "%zu invalid utf-8 sequences, shown as U+FFFD\n", loader->utf8_errors);
+        loader->utf8_errors = 0;
+    }
+    return true;
+}
+
+void uring_loader_close(struct uring_loader *loader) {
+    // reads still in flight write into the document, wait for them; queued ones go away with the ring unsubmitted
+    loader->queued = 0;
+    while (loader->in_flight > 0 && loader->ring_fd >= 0) {
+        if (!ring_enter(loader, 1)) break;
+        unsigned head = *loader->cq_head;
+        const unsigned tail = load_acquire(loader->cq_tail);
+        loader->in_flight -= tail - head;
+        store_release(loader->cq_head, tail);
+    }
+    if (loader->sqes && loader->sqes != MAP_FAILED) munmap(loader->sqes, URING_QUEUE_DEPTH * sizeof(struct io_uring_sqe));
+    if (loader->cq_ring && loader->cq_ring != MAP_FAILED && loader->cq_ring != loader->sq_ring) munmap(loader->cq_ring, loader->cq_ring_size);
+    if (loader->sq_ring && loader->sq_ring != MAP_FAILED) munmap(loader->sq_ring, loader->sq_ring_size);
+    if (loader->ring_fd >= 0) close(loader->ring_fd);
+    if (loader->file_fd >= 0) close(loader->file_fd);
+    free(loader->chunk_read);
+    memset(loader, 0, sizeof(*loader));
+    loader->ring_fd = loader->file_fd = -1;
+}
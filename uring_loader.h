@@ -0,0 +1,47 @@
+#ifndef URING_LOADER_H
+#define URING_LOADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "text.h"
+
+// loads a document with queued io_uring reads into anonymous memory instead of mapping the file
+// pages of a mapped file on slow storage fault in whenever a thread first touches them, read memory never does
+// each chunk goes through line indexing and utf-8 validation as soon as it and everything before it arrived
+#define URING_CHUNK_SIZE (1 << 20)
+#define URING_QUEUE_DEPTH 8
+
+struct uring_loader {
+    int ring_fd, file_fd;
+    // shared rings, mapped from the kernel
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+    struct io_uring_sqe *sqes;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    // progress
+    uint32_t *chunk_read;  // bytes read per chunk
+    size_t chunk_count;
+    size_t next_chunk;     // first chunk not submitted yet
+    size_t queued;         // reads in the sq ring the kernel has not taken yet
+    size_t in_flight;      // reads the kernel took and has not completed
+    size_t loaded;         // bytes loaded without gaps from the start of the file
+    size_t validated;      // bytes checked for utf-8 errors
+    size_t utf8_errors;
+    bool failed;
+};
+
+// opens path and starts reading, doc is usable (with 0 lines indexed) right away
+// event_fd, an eventfd or -1, is signalled whenever reads complete, so the caller can sleep on it instead of polling
+// returns false if the file or io_uring reads are not available, use document_load then
+bool uring_loader_open(struct uring_loader *loader, struct document *doc, const char *path, int event_fd);
+// reaps finished reads, indexes and validates what arrived, queues more
+// wait blocks for at least one read if none finished yet, returns true once the whole file is loaded or on failure
+// after a failure (failed is set) the document is incomplete, close the loader and load it with document_load
+bool uring_loader_poll(struct uring_loader *loader, struct document *doc, bool wait);
+void uring_loader_close(struct uring_loader *loader);
+
+#endif
@@ -1,8 +1,23 @@
 #include <sys/mman.h>
+#include <poll.h>
+
+#include "layout.h"
+#include "cpu_draw.h"
+#include "frame_stats.h"
+#include "idle.h"
+#include "trace.h"
+#include "protocol_stats.h"
+#include "helper/util.h"
 
 struct wl_compositor* compositor = NULL; // compositor api (creates surfaces, can have subsurfaces and overlay)
 struct xdg_wm_base* wm_base = NULL; // wm api (creates 'toplevel' surfaces ~= windows)
 
+struct document document; // text shown in the window
+struct layout layout; // draw list recorded from the document once per change, replayed by the cpu and egl backends
+struct idle_scheduler idle; // low priority work for what is left of each frame after the commit
+
+#define IDLE_INDEX_BYTES (1 << 20)
+
 // -IMPORTANT FUNCTION (but boilerplate that should be hidden away)
 static void registry_handler(void* data, struct wl_registry* registry, uint32_t name, const char* interface,
                              uint32_t version)
@@ -45,24 +60,49 @@ static const struct wl_registry_listener registry_listener = {
 // callback for ping events from the compositor to keep the connection alive.
 static void wm_base_ping(void* data, struct xdg_wm_base* xdg_wm_base, uint32_t serial)
 {
-    xdg_wm_base_pong(xdg_wm_base, serial); // send pong with the same serial number
+    PROTOCOL_REQUEST(xdg_wm_base_pong(xdg_wm_base, serial)); // send pong with the same serial number
 }
 static const struct xdg_wm_base_listener wm_base_listener = {
     .ping = wm_base_ping, // Called when the compositor sends a ping
 };
 
 // Drawing function for CPU rendering
-void draw_to_subsurface()
+void draw_to_subsurface(const struct draw_list* list)
 {
-    uint32_t* pixels = buffer_data;
-    // Draw something...
-    for (int i = 0; i < 256 * 256; i++)
-    {
-        pixels[i] = 0xFF0000FF; // Example: solid blue
-    }
-    wl_surface_attach(second_surface, cpu_buffer, 0, 0);
-    wl_surface_damage_buffer(second_surface, 0, 0, width, height);
-    wl_surface_commit(second_surface);
+    static uint32_t drawn_generation = 0;
+    // the subsurface keeps showing its buffer, only replay when the list changed
+    if (list->generation == drawn_generation)
+        return;
+    drawn_generation = list->generation;
+    const struct cpu_target target = {buffer_data, 256, 256, 256};
+    cpu_draw_list(list, &target);
+    PROTOCOL_REQUEST(wl_surface_attach(second_surface, cpu_buffer, 0, 0));
+    PROTOCOL_REQUEST(wl_surface_damage_buffer(second_surface, 0, 0, 256, 256));
+    PROTOCOL_REQUEST(wl_surface_commit(second_surface));
+}
+
+// idle task: extends the line index a chunk at a time
+static bool idle_index_lines(void* arg)
+{
+    return !document_index_lines(&document, IDLE_INDEX_BYTES);
+}
+
+// load the document and index the first chunk of its lines, the rest is indexed in idle time
+bool init_text(const char* path)
+{
+    if (!document_load(&document, path))
+        return false;
+    document_index_lines(&document, IDLE_INDEX_BYTES);
+    idle_init(&idle);
+    idle_add(&idle, idle_index_lines, NULL);
+    return true;
+}
+
+// idle work stops as soon as the compositor has something for us
+static bool wayland_input_pending(void* arg)
+{
+    struct pollfd fd = {wl_display_get_fd(display), POLLIN};
+    return poll(&fd, 1, 0) > 0;
 }
 
 // Helper function to create shared memory
@@ -118,18 +158,43 @@ int create_cpu_subsurface(void)
 }
 
 // declare draw_egl() to avoid symbol not found
-void draw_egl(); // egl.c
+void draw_egl(const struct draw_list* list); // egl.c
+void egl_add_damage(int x, int y, int w, int h); // egl.c
 // -Important function
 // callback that the compositor calls when a frame is done
 static void frame_done(void* data, struct wl_callback* callback, uint32_t time)
 {
+    const uint64_t frame_zone = trace_begin();
     wl_callback_destroy(callback);
+    idle_frame_done(&idle, get_time_ns());
     // if still running, draw the next frame
     if (running)
     {
-        draw_to_subsurface();
-        draw_egl();
+        frame_stats_begin();
+        // record once, both backends replay the same list
+        const struct view view = {.width = width, .height = height, .font_size = 16,
+                                  .background = 0xFF1E1E1E, .foreground = 0xFFD4D4D4};
+        uint64_t zone = trace_begin();
+        // a new layout damages the whole view, an unchanged one nothing, which swaps with an empty damage rect
+        if (layout_update(&layout, &document, &view))
+            egl_add_damage(layout.damage_x0, layout.damage_y0, layout.damage_x1 - layout.damage_x0,
+                           layout.damage_y1 - layout.damage_y0);
+        trace_end("layout", zone);
+        zone = trace_begin();
+        draw_to_subsurface(&layout.list);
+        trace_end("raster", zone);
+        zone = trace_begin();
+        draw_egl(&layout.list);
+        trace_end("commit", zone);
+        if (frame_stats.upload_bytes)
+            frame_stats_print(stdout);
+        protocol_frame_end(stdout);
+        // the frame is committed, what is left of the interval is idle time
+        zone = trace_begin();
+        idle_run(&idle, idle_deadline(&idle, get_time_ns()), wayland_input_pending, NULL);
+        trace_end("idle", zone);
     }
+    trace_end("frame callback", frame_zone);
 }
 static const struct wl_callback_listener frame_listener = {
     .done = frame_done,